@@ -0,0 +1,189 @@
+/*
+ * memlib.c
+ *
+ * Memory provider for the allocators: mem_sbrk moves a break inside a
+ * mapping of max_heap bytes reserved at mem_init, without swap
+ * reservation, so pages cost nothing until touched and the heap never
+ * moves. Fresh heap memory is zero: the mapping is anonymous and
+ * mem_reset_brk discards the pages it takes back.
+ *
+ * Heap growth can be given a simulated cost (mem_configure) to see
+ * how an allocator behaves when extending the heap is expensive, and
+ * mem_get_stats counts what the allocator asked for.
+ *
+ * The allocator serializes mem_sbrk and mem_reset_brk (mm.c calls
+ * them under its heap lock); the bounds can be read at any time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+
+/* private variables */
+static char *mem_start_brk;  /* points to first byte of heap */
+static char *mem_brk;        /* points to last byte of heap plus 1 */
+static char *mem_max_addr;   /* max legal heap addr plus 1 */
+
+static struct mem_config mem_conf = { MEM_MAX_HEAP, 0, 0 };
+static struct mem_stats mem_stats;
+
+static void mem_cost(long ns);
+
+/*
+ * mem_configure - set the maximum heap and growth cost, before the
+ * heap is first used
+ */
+int mem_configure(const struct mem_config *conf)
+{
+    if (mem_start_brk != NULL)
+	return -1;
+    mem_conf.max_heap = conf->max_heap? conf->max_heap : MEM_MAX_HEAP;
+    mem_conf.sbrk_ns = conf->sbrk_ns > 0? conf->sbrk_ns : 0;
+    mem_conf.page_ns = conf->page_ns > 0? conf->page_ns : 0;
+    return 0;
+}
+
+/*
+ * mem_init - reserve the mapping the heap grows in, if not yet done
+ */
+void mem_init(void)
+{
+    char *p;
+
+    if (mem_start_brk != NULL)
+	return;
+    p = mmap(NULL, mem_conf.max_heap, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+	fprintf(stderr, "mem_init: cannot reserve %lu bytes\n",
+		(unsigned long)mem_conf.max_heap);
+	exit(1);
+    }
+    mem_start_brk = mem_brk = p;
+    mem_max_addr = p + mem_conf.max_heap;
+    memset(&mem_stats, 0, sizeof(mem_stats));
+}
+
+/*
+ * mem_deinit - release the mapping, the next use reserves a new one
+ */
+void mem_deinit(void)
+{
+    if (mem_start_brk == NULL)
+	return;
+    munmap(mem_start_brk, mem_conf.max_heap);
+    mem_start_brk = mem_brk = mem_max_addr = NULL;
+}
+
+/*
+ * mem_reset_brk - reset the simulated brk pointer to make an empty
+ * heap, the pages handed out are discarded so they come back zero
+ */
+void mem_reset_brk(void)
+{
+    if (mem_start_brk == NULL)
+	return;
+    if (mem_brk > mem_start_brk)
+	madvise(mem_start_brk, mem_brk - mem_start_brk, MADV_DONTNEED);
+    mem_brk = mem_start_brk;
+    mem_stats.resets++;
+}
+
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
+ * by incr bytes and returns the start address of the new area. In
+ * this model, the heap cannot be shrunk.
+ * return (void *)-1 with errno ENOMEM if the heap would pass max_heap
+ */
+void *mem_sbrk(int incr)
+{
+    char *old_brk;
+    size_t pagesize = mem_pagesize();
+    size_t pages;
+
+    mem_init();
+    old_brk = mem_brk;
+    if (incr < 0 || incr > mem_max_addr - mem_brk) {
+	mem_stats.sbrk_failed++;
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    mem_brk += incr;
+
+    /* pages the heap gained: its end crossed into them */
+    pages = ((size_t)(mem_brk - mem_start_brk) + pagesize - 1) / pagesize -
+	    ((size_t)(old_brk - mem_start_brk) + pagesize - 1) / pagesize;
+    if (mem_conf.sbrk_ns || mem_conf.page_ns)
+	mem_cost(mem_conf.sbrk_ns + (long)pages * mem_conf.page_ns);
+
+    mem_stats.sbrk_calls++;
+    mem_stats.sbrk_bytes += incr;
+    if ((size_t)(mem_brk - mem_start_brk) > mem_stats.peak_heap)
+	mem_stats.peak_heap = mem_brk - mem_start_brk;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo(void)
+{
+    return (void *)mem_start_brk;
+}
+
+/*
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi(void)
+{
+    return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize(void)
+{
+    return (size_t)(mem_brk - mem_start_brk);
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize(void)
+{
+    static size_t pagesize;
+
+    if (pagesize == 0)
+	pagesize = (size_t)getpagesize();
+    return pagesize;
+}
+
+/*
+ * mem_get_stats - copy of the counters
+ */
+void mem_get_stats(struct mem_stats *stats)
+{
+    *stats = mem_stats;
+}
+
+/*
+ * mem_cost - spin for ns nanoseconds, the simulated cost of growth:
+ * a sleep would add the scheduler's latency on top
+ */
+static void mem_cost(long ns)
+{
+    struct timespec t0, t;
+    long spent;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	spent = (t.tv_sec - t0.tv_sec) * 1000000000L + (t.tv_nsec - t0.tv_nsec);
+    } while (spent < ns);
+    mem_stats.cost_ns += spent;
+}
@@ -0,0 +1,53 @@
+/*
+ * memlib.h
+ *
+ * Interface to the memory provider in memlib.c: a heap grown by
+ * mem_sbrk inside one mapping reserved up front, so the heap is
+ * contiguous and its bounds are known.
+ */
+#ifndef MEMLIB_H
+#define MEMLIB_H
+
+#include <unistd.h>
+
+void mem_init(void);
+void mem_deinit(void);
+void *mem_sbrk(int incr);
+void mem_reset_brk(void);
+void *mem_heap_lo(void);
+void *mem_heap_hi(void);
+size_t mem_heapsize(void);
+size_t mem_pagesize(void);
+
+/*
+ * Configuration, set with mem_configure before the heap is first used
+ * (mem_init or mem_sbrk): the maximum heap size and a cost model for
+ * heap growth. The cost is simulated by spinning in mem_sbrk, so a
+ * benchmark can make growth as expensive as it likes without paying
+ * for real system calls. Zero fields keep their defaults (max_heap
+ * MEM_MAX_HEAP, no added cost).
+ */
+#define MEM_MAX_HEAP (1UL<<32) /* 32-bit heap offsets, see mm.c */
+
+struct mem_config {
+	size_t max_heap;   /* bytes reserved, mem_sbrk fails beyond */
+	long sbrk_ns;      /* cost of each mem_sbrk call */
+	long page_ns;      /* cost of each page a mem_sbrk call adds */
+};
+
+/* return 0 if success, -1 if the heap is already in use */
+int mem_configure(const struct mem_config *conf);
+
+/* Counters since the heap was reserved (mem_init) */
+struct mem_stats {
+	unsigned long sbrk_calls;   /* mem_sbrk calls served */
+	unsigned long sbrk_failed;  /* mem_sbrk calls refused */
+	size_t sbrk_bytes;          /* bytes they added */
+	unsigned long resets;       /* mem_reset_brk calls */
+	size_t peak_heap;           /* largest heap size */
+	unsigned long cost_ns;      /* time spent on the simulated cost */
+};
+
+void mem_get_stats(struct mem_stats *stats);
+
+#endif /* MEMLIB_H */
@@ -0,0 +1,177 @@
+/*
+ * mm-core.h
+ *
+ * What the allocator engines (mm.c, mm-seglist.c) share: the boundary
+ * tag block format, the heap checks every engine's checker starts with
+ * and the heap walk behind their statistics. Both engines get their
+ * memory from memlib and lay the heap out the same way: padding, an
+ * allocated prologue block of DSIZE, the blocks, and a size 0
+ * allocated epilogue header at the heap end.
+ *
+ * A block is [header][payload][footer] with 4-byte tags holding the
+ * size (a multiple of 8) and the allocated bit in bit 0. Bits 1-2 are
+ * the engine's own (mm.c: allocation tag, mm-seglist.c: previous
+ * block allocated), so PACK stays in the engine.
+ *
+ * Include after mm.h and memlib.h, with ALIGN16 defined before if wanted
+ * (mm.c only).
+ */
+#ifndef MM_CORE_H
+#define MM_CORE_H
+
+#include <setjmp.h>
+
+#include "mm-index.h"
+
+/* single word (4) or double word (8) alignment, or 16 with ALIGN16 */
+#ifdef ALIGN16
+#define ALIGNMENT 16
+#else
+#define ALIGNMENT 8
+#endif
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
+
+/* Basic constants and macros */
+#define WSIZE       4       /* Word and header/footer size (bytes) */
+#define DSIZE       8       /* Doubleword size (bytes) */
+#define CHUNKSIZE  (1<<12)  /* Extend heap by this amount (bytes) */
+#define MIN_BLK_SIZE 16 /* minimum block size (bytes) */
+
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+
+/* Read and write a word at address p */
+#define GET(p)       (*(unsigned int *)(p))
+#define PUT(p, val)  (*(unsigned int *)(p) = (val))
+
+/* Read the size and allocated fields from address p */
+#define GET_SIZE(p)  (GET(p) & ~0x7)
+#define GET_ALLOC(p) (GET(p) & 0x1)
+
+/* Given block ptr bp, compute address of its header and footer */
+#define HDRP(bp)       ((char *)(bp) - WSIZE)
+#define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+
+/* Given block ptr bp, compute address of next and previous blocks */
+#define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
+#define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
+
+/*
+ * Return whether the pointer is in the heap.
+ * May be useful for debugging.
+ */
+static inline int in_heap(const void *p) {
+    return p <= mem_heap_hi() && p >= mem_heap_lo();
+}
+
+/*
+ * Return whether the pointer is aligned.
+ * May be useful for debugging.
+ */
+static inline int aligned(const void *p) {
+    return (size_t)ALIGN(p) == (size_t)p;
+}
+
+/*
+ * A failed check prints a report and exits, unless the engine sets
+ * check_quiet: then it prints nothing and longjmps to check_jmp with
+ * the value 1 (a forked child must not touch stdio or atexit work)
+ */
+static int check_quiet __attribute__((unused));
+static jmp_buf check_jmp __attribute__((unused));
+#define CHECK_PRINTF(...) do { if (!check_quiet) printf(__VA_ARGS__); } while (0)
+#define CHECK_FAIL() \
+	do { if (check_quiet) longjmp(check_jmp, 1); exit(1); } while (0)
+
+/*
+ * core_checkheap - the checks common to the engines, fail on error
+ * 1. prologue: allocated, DSIZE, header and footer agree
+ * 2. epilogue: allocated, size 0, at the heap end
+ * 3. every block aligned, in the heap, at least MIN_BLK_SIZE and
+ *    marked in the block start index
+ * 4. every free block's header and footer agree and no two free
+ *    blocks are neighbours (coalescing)
+ * 5. the walk ends at the epilogue
+ */
+static void core_checkheap(char *heap_listp, int lineno) {
+	char *bp, *hdrp, *ftrp;
+	unsigned int prev_alloc = 1;
+
+	hdrp = HDRP(heap_listp);
+	ftrp = FTRP(heap_listp);
+	if (GET_SIZE(hdrp) != DSIZE || !GET_ALLOC(hdrp) ||
+		GET_SIZE(ftrp) != DSIZE || !GET_ALLOC(ftrp)) {
+		CHECK_PRINTF("line %d: prologue wrong!\n", lineno);
+		CHECK_PRINTF("header: (size %u, alloc %u), footer: (size %u, alloc %u)\n",
+		       GET_SIZE(hdrp), GET_ALLOC(hdrp), GET_SIZE(ftrp), GET_ALLOC(ftrp));
+		CHECK_FAIL();
+	}
+	hdrp = HDRP((char *)mem_heap_hi() + 1);
+	if (GET_SIZE(hdrp) != 0 || !GET_ALLOC(hdrp)) {
+		CHECK_PRINTF("line %d: epilogue wrong!\n", lineno);
+		CHECK_PRINTF("size: %u, alloc: %u\n", GET_SIZE(hdrp), GET_ALLOC(hdrp));
+		CHECK_FAIL();
+	}
+	for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+		hdrp = HDRP(bp);
+		ftrp = FTRP(bp);
+		if (!aligned(bp) || !in_heap(bp) || !in_heap(ftrp + WSIZE - 1)) {
+			CHECK_PRINTF("line %d: blk %p not aligned or not in heap!\n", lineno, bp);
+			CHECK_PRINTF("heap_lo: %p, heap_hi: %p\n", mem_heap_lo(), mem_heap_hi());
+			CHECK_FAIL();
+		}
+		if (GET_SIZE(hdrp) < MIN_BLK_SIZE) {
+			CHECK_PRINTF("line %d: blk %p size %u < MIN_BLK_SIZE!\n",
+			       lineno, bp, GET_SIZE(hdrp));
+			CHECK_FAIL();
+		}
+		if (idx_find(bp) != bp || idx_find(ftrp + WSIZE - 1) != bp) {
+			CHECK_PRINTF("line %d: blk %p not in the start index!\n", lineno, bp);
+			CHECK_FAIL();
+		}
+		if (!GET_ALLOC(hdrp)) {
+			if (GET_SIZE(hdrp) != GET_SIZE(ftrp) || GET_ALLOC(ftrp)) {
+				CHECK_PRINTF("line %d: free blk %p hdr/ftr not matched!\n", lineno, bp);
+				CHECK_PRINTF("hdr size %u, ftr size %u, ftr alloc %u\n",
+				       GET_SIZE(hdrp), GET_SIZE(ftrp), GET_ALLOC(ftrp));
+				CHECK_FAIL();
+			}
+			if (!prev_alloc) {
+				CHECK_PRINTF("line %d: free blk %p and the one before not coalesced!\n",
+				       lineno, bp);
+				CHECK_FAIL();
+			}
+		}
+		prev_alloc = GET_ALLOC(hdrp);
+	}
+	if (bp != (char *)mem_heap_hi() + 1) {
+		CHECK_PRINTF("line %d: block walk ends at %p, heap end %p!\n",
+		       lineno, bp, (char *)mem_heap_hi() + 1);
+		CHECK_FAIL();
+	}
+}
+
+/*
+ * core_heap_stats - heap size and free blocks by a walk of the heap,
+ * the caller keeps the heap still
+ */
+static void core_heap_stats(char *heap_listp, struct mm_heap_stats *st) {
+	char *bp;
+	size_t size;
+
+	memset(st, 0, sizeof(*st));
+	if (heap_listp == NULL)
+		return;
+	st->heap_bytes = mem_heapsize();
+	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+		if (!GET_ALLOC(HDRP(bp))) {
+			size = GET_SIZE(HDRP(bp));
+			st->free_blocks++;
+			st->free_bytes += size;
+			st->largest_free = MAX(st->largest_free, size);
+		}
+	}
+}
+
+#endif /* MM_CORE_H */
@@ -0,0 +1,117 @@
+/*
+ * mm-engine.c
+ *
+ * Entry points for a binary holding both allocator engines: mm_init,
+ * malloc, free, realloc, calloc, mm_checkheap, mm_block_of and
+ * mm_heap_stats go to the engine selected at run time, by
+ * mm_engine_select or the MM_ENGINE environment variable ("list" or
+ * "seg", "list" by default). See mm-engine.h.
+ *
+ * Build: gcc -O2 -DMM_ENGINES [-DDRIVER] -c mm.c mm-seglist.c mm-engine.c memlib.c
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm.h"
+#include "mm-engine.h"
+
+/* do not change the following! */
+#ifdef DRIVER
+/* create aliases for driver tests */
+#define malloc mm_malloc
+#define free mm_free
+#define realloc mm_realloc
+#define calloc mm_calloc
+#endif /* def DRIVER */
+
+static const struct mm_engine *const engines[] = {
+	&mm_list_engine,
+	&mm_seg_engine,
+};
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+/* current engine, NULL until selected or first used */
+static const struct mm_engine *current;
+
+static const struct mm_engine *find_engine(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ENGINES; i++)
+		if (strcmp(engines[i]->name, name) == 0)
+			return engines[i];
+	return NULL;
+}
+
+/*
+ * mm_engine - the current engine, from MM_ENGINE on first use.
+ * Racing first users compute the same engine.
+ */
+const struct mm_engine *mm_engine(void)
+{
+	const struct mm_engine *e = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+	const char *name;
+
+	if (__builtin_expect(e == NULL, 0)) {
+		name = getenv("MM_ENGINE");
+		if (name == NULL || (e = find_engine(name)) == NULL)
+			e = engines[0];
+		__atomic_store_n(&current, e, __ATOMIC_RELEASE);
+	}
+	return e;
+}
+
+int mm_engine_select(const char *name)
+{
+	const struct mm_engine *e = find_engine(name);
+
+	if (e == NULL)
+		return -1;
+	__atomic_store_n(&current, e, __ATOMIC_RELEASE);
+	return 0;
+}
+
+const char *mm_engine_name(void)
+{
+	return mm_engine()->name;
+}
+
+int mm_init(void)
+{
+	return mm_engine()->init();
+}
+
+void *malloc(size_t size)
+{
+	return mm_engine()->alloc(size);
+}
+
+void free(void *ptr)
+{
+	mm_engine()->dealloc(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	return mm_engine()->resize(ptr, size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	return mm_engine()->zalloc(nmemb, size);
+}
+
+void mm_checkheap(int lineno)
+{
+	mm_engine()->check(lineno);
+}
+
+void *mm_block_of(const void *addr, size_t *size)
+{
+	return mm_engine()->block_of(addr, size);
+}
+
+void mm_heap_stats(struct mm_heap_stats *stats)
+{
+	mm_engine()->heap_stats(stats);
+}
@@ -0,0 +1,52 @@
+/*
+ * mm-engine.h
+ *
+ * Engine table: the operations an allocator engine provides over the
+ * shared heap format of mm-core.h. With -DMM_ENGINES each engine file
+ * prefixes its entry points (mm.c list_, mm-seglist.c seg_) and
+ * exports its table; mm-engine.c owns the real entry points and calls
+ * the selected engine through it.
+ *
+ * Every engine grows the one memlib heap, so one engine runs a heap at
+ * a time: mm_engine_select switches between heaps (the driver resets
+ * the heap before each mm_init), not within one.
+ */
+#ifndef MM_ENGINE_H
+#define MM_ENGINE_H
+
+#include "mm.h"
+
+/* member names avoid malloc/free/realloc/calloc, which DRIVER redefines */
+struct mm_engine {
+	const char *name;
+	int (*init)(void);
+	void *(*alloc)(size_t size);
+	void (*dealloc)(void *ptr);
+	void *(*resize)(void *ptr, size_t size);
+	void *(*zalloc)(size_t nmemb, size_t size);
+	void (*check)(int lineno);
+	void *(*block_of)(const void *addr, size_t *size);
+	void (*heap_stats)(struct mm_heap_stats *stats);
+};
+
+extern const struct mm_engine mm_list_engine; /* mm.c */
+extern const struct mm_engine mm_seg_engine;  /* mm-seglist.c */
+
+/* the engines' prefixed entry points, for calls inside each engine */
+#define MM_ENGINE_DECLARE(prefix) \
+	int prefix##_init(void); \
+	void *prefix##_malloc(size_t size); \
+	void prefix##_free(void *ptr); \
+	void *prefix##_realloc(void *ptr, size_t size); \
+	void *prefix##_calloc(size_t nmemb, size_t size); \
+	void prefix##_checkheap(int lineno); \
+	void *prefix##_block_of(const void *addr, size_t *size); \
+	void prefix##_heap_stats(struct mm_heap_stats *stats)
+
+MM_ENGINE_DECLARE(list);
+MM_ENGINE_DECLARE(seg);
+
+/* the engine running the heap, chosen on first use */
+extern const struct mm_engine *mm_engine(void);
+
+#endif /* MM_ENGINE_H */
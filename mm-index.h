@@ -0,0 +1,127 @@
+/*
+ * mm-index.h
+ *
+ * Block start index for interior pointer lookup (mm_block_of), shared
+ * by the allocator engines. One bit per 8 bytes of heap marks where a
+ * block's payload starts; the engine sets a bit when a split creates a
+ * block and clears it when coalescing merges one away. Summary levels
+ * above it keep one bit per non-zero word of the level below, so the
+ * block containing an address (the last start at or before it) is
+ * found in one step per level, at most 6 for a 4 GB heap.
+ *
+ * The bitmaps take 1/64 of the heap size, reserved up front without
+ * swap reservation and touched only as the heap grows. The engine
+ * serializes the calls (mm.c holds the heap lock).
+ */
+#ifndef MM_INDEX_H
+#define MM_INDEX_H
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define IDX_GRAIN  8          /* bytes per level 0 bit */
+#define IDX_LEVELS 6          /* the top level is a single word */
+
+static struct {
+	char *base;                   /* heap offsets are from here */
+	uint64_t *lv[IDX_LEVELS];
+	size_t bytes;                 /* size of the reservation */
+	int top;                      /* highest level in use */
+} blk_index;
+
+/*
+ * idx_init - reserve the index for a heap of up to max bytes at base,
+ * or clear it if it exists. return 0 if success, -1 if error
+ */
+static int idx_init(char *base, size_t max)
+{
+	size_t bits = max / IDX_GRAIN, words, off = 0;
+	char *p;
+	int k;
+
+	blk_index.base = base;
+	if (blk_index.lv[0]) {
+		madvise(blk_index.lv[0], blk_index.bytes, MADV_DONTNEED);
+		return 0;
+	}
+	for (k = 0; k < IDX_LEVELS; k++) {
+		words = (bits + 63) / 64;
+		off += words * sizeof(uint64_t);
+		bits = words;
+	}
+	p = mmap(NULL, off, PROT_READ | PROT_WRITE,
+	         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	blk_index.bytes = off;
+	bits = max / IDX_GRAIN;
+	for (k = 0; k < IDX_LEVELS; k++) {
+		blk_index.lv[k] = (uint64_t *)p;
+		words = (bits + 63) / 64;
+		p += words * sizeof(uint64_t);
+		blk_index.top = k;
+		if (words == 1)
+			break;
+		bits = words;
+	}
+	return 0;
+}
+
+/* idx_set - mark a block starting at bp */
+static inline void idx_set(const void *bp)
+{
+	size_t pos = ((const char *)bp - blk_index.base) / IDX_GRAIN;
+	uint64_t was;
+	int k;
+
+	for (k = 0; k <= blk_index.top; k++) {
+		was = blk_index.lv[k][pos / 64];
+		blk_index.lv[k][pos / 64] = was | (1ULL << (pos % 64));
+		if (was)
+			break;
+		pos /= 64;
+	}
+}
+
+/* idx_clear - unmark a block merged away at bp */
+static inline void idx_clear(const void *bp)
+{
+	size_t pos = ((const char *)bp - blk_index.base) / IDX_GRAIN;
+	int k;
+
+	for (k = 0; k <= blk_index.top; k++) {
+		if ((blk_index.lv[k][pos / 64] &= ~(1ULL << (pos % 64))))
+			break;
+		pos /= 64;
+	}
+}
+
+/*
+ * idx_find - the last marked block start at or before p, NULL if none
+ * 1. climb while the word holding the position has no bit at or
+ *    below it, the position becomes the previous word's
+ * 2. descend taking the highest bit of each word
+ */
+static inline char *idx_find(const void *p)
+{
+	size_t pos = ((const char *)p - blk_index.base) / IDX_GRAIN;
+	uint64_t m;
+	int k;
+
+	if (blk_index.lv[0] == NULL)
+		return NULL;
+	for (k = 0; ; k++) {
+		m = blk_index.lv[k][pos / 64] & ((2ULL << (pos % 64)) - 1);
+		if (m)
+			break;
+		if (k == blk_index.top || pos < 64)
+			return NULL;
+		pos = pos / 64 - 1;
+	}
+	pos = (pos & ~(size_t)63) + 63 - __builtin_clzll(m);
+	for (; k > 0; k--)
+		pos = pos * 64 + 63 - __builtin_clzll(blk_index.lv[k-1][pos]);
+	return blk_index.base + pos * IDX_GRAIN;
+}
+
+#endif /* MM_INDEX_H */
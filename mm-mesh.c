@@ -0,0 +1,664 @@
+/*
+ * mm-mesh.c
+ *
+ * Mesh arena (see mm-mesh.h). The file is as large as the reserved
+ * range and starts out mapped one to one: virtual page v on file page
+ * v. Pages are used from the bottom (top marks the end of what was
+ * ever used). Every file page holding slots has a span, indexed by the
+ * file page, with the used slot bitmap and the virtual pages mapped on
+ * it; vmap sends a virtual page to its file page. A span's own virtual
+ * page is always one of them.
+ *
+ * Meshing a span src into dst, same slot size, no used slot in common:
+ * 1. src's virtual pages are write protected and its used slots copied
+ *    to the same slots of dst
+ * 2. src's virtual pages are remapped onto dst's file page, and src's
+ *    file page is punched out of the file (released)
+ * When a meshed span empties, its other virtual pages go back to their
+ * own (released) file pages. Empty spans' pages are kept in memory
+ * until the next meshing pass releases them.
+ *
+ * Each remapped page is a mapping of its own, so the pages remapped at
+ * a time are bounded (MESH_REMAP_MAX) to stay clear of the kernel's
+ * limit on mappings.
+ */
+#define _GNU_SOURCE /* memfd_create, fallocate */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "mm-mesh.h"
+
+#define MESH_PAGES      (MESH_ARENA >> MESH_PAGE_SHIFT)
+#define MESH_CLASSES    (MESH_MAX / 8 - 1)  /* slot sizes 16, 24, ..., MESH_MAX */
+#define MESH_IDX(size)  ((size) / 8 - 2)
+#define MESH_SLOTS      ((MESH_PAGE_SIZE - MESH_SKIP) / 16) /* most per page */
+#define MESH_WORDS      ((MESH_SLOTS + 63) / 64)
+#define MESH_ALIASES    8     /* most virtual pages on one file page */
+#define MESH_CANDIDATES 1024  /* spans looked at per size and pass */
+#define MESH_PROBES     64    /* partners tried for each span */
+#define MESH_REMAP_MAX  16384 /* most virtual pages remapped at a time */
+#define MESH_PASS_MAX   256   /* most meshes of a background pass */
+#define MESH_SLICE      16    /* most meshes per hold of the lock */
+
+#define PAGE_ADDR(v)    (mesh.base + ((size_t)(v) << MESH_PAGE_SHIFT))
+
+struct mspan {
+	uint64_t map[MESH_WORDS];        /* used slots */
+	unsigned short size;             /* slot size */
+	unsigned short nslots;
+	unsigned short used;
+	unsigned char nvirt;
+	unsigned char partial;           /* on the partial list of its size */
+	unsigned int virt[MESH_ALIASES]; /* virtual pages mapped on it */
+	unsigned int next, prev;         /* partial list, file page + 1 */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	char *base;                 /* reserved range, NULL until used */
+	int fd;                     /* the file */
+	unsigned int *vmap;         /* virtual page to file page + 1, 0 if free */
+	struct mspan *spans;        /* by file page */
+	unsigned int *dirty;        /* free pages maybe in memory */
+	unsigned int *clean;        /* free pages released */
+	size_t ndirty, nclean;
+	size_t top;                 /* pages ever used */
+	unsigned int partial[MESH_CLASSES]; /* spans with free slots */
+	size_t remapped;            /* virtual pages not on their file page */
+	size_t pages, phys_pages, used_bytes, meshes, released;
+	unsigned long frees;
+	int worker;                 /* the background thread is running */
+	unsigned int seq;           /* meshings begun and ended, odd during one */
+	struct sigaction old_segv;  /* SIGSEGV action before ours */
+	int fork_pipe[2];           /* parent waits on it for the child's copy */
+} mesh = { PTHREAD_MUTEX_INITIALIZER, NULL, -1 };
+
+static int mesh_setup(void);
+static int span_new(size_t size);
+static void span_free(unsigned int p);
+static void partial_insert(unsigned int p);
+static void partial_remove(unsigned int p);
+static size_t compact(size_t budget);
+static size_t mesh_class(int c, size_t budget);
+static int meshable(struct mspan *a, struct mspan *b);
+static int mesh_pair(unsigned int dst, unsigned int src);
+static void release_dirty(void);
+static void punch(unsigned int p);
+static void mesh_start(void);
+static void *mesh_thread(void *arg);
+static void mesh_fault(int sig, siginfo_t *si, void *ctx);
+static void mesh_prepare(void);
+static void mesh_parent(void);
+static void mesh_child(void);
+
+/*
+ * mesh_alloc - the lowest free slot of the first span with free slots
+ * of this size, a new span if there is none
+ */
+void *mesh_alloc(size_t size)
+{
+	struct mspan *s;
+	unsigned int p, i, w;
+	char *slot = NULL;
+
+	if (size < 16 || size > MESH_MAX || size % 8)
+		return NULL;
+	pthread_mutex_lock(&mesh.lock);
+	if (mesh.base == NULL && mesh_setup() == -1)
+		goto out;
+	if (mesh.partial[MESH_IDX(size)] == 0 && span_new(size) == -1)
+		goto out;
+	p = mesh.partial[MESH_IDX(size)] - 1;
+	s = &mesh.spans[p];
+	for (w = 0; ~s->map[w] == 0; w++)
+		;
+	i = w * 64 + __builtin_ctzll(~s->map[w]);
+	s->map[w] |= 1UL << (i % 64);
+	s->used++;
+	mesh.used_bytes += size;
+	if (s->used == s->nslots)
+		partial_remove(p);
+	slot = PAGE_ADDR(s->virt[0]) + MESH_SKIP + i * size;
+out:
+	pthread_mutex_unlock(&mesh.lock);
+	return slot;
+}
+
+/*
+ * mesh_free - free a slot through any of its virtual pages, start the
+ * background thread on the first free
+ */
+void mesh_free(void *slot)
+{
+	size_t off = (char *)slot - mesh.base;
+	struct mspan *s;
+	unsigned int p, i;
+
+	pthread_mutex_lock(&mesh.lock);
+	p = mesh.vmap[off >> MESH_PAGE_SHIFT] - 1;
+	s = &mesh.spans[p];
+	i = ((off & (MESH_PAGE_SIZE - 1)) - MESH_SKIP) / s->size;
+	s->map[i / 64] &= ~(1UL << (i % 64));
+	s->used--;
+	mesh.used_bytes -= s->size;
+	if (s->used == 0)
+		span_free(p);
+	else if (!s->partial)
+		partial_insert(p);
+	__atomic_store_n(&mesh.frees, mesh.frees + 1, __ATOMIC_RELAXED);
+	if (!mesh.worker)
+		mesh_start();
+	pthread_mutex_unlock(&mesh.lock);
+}
+
+int mesh_owns(const void *addr)
+{
+	char *base = __atomic_load_n(&mesh.base, __ATOMIC_ACQUIRE);
+
+	return base && (char *)addr >= base && (char *)addr < base + MESH_ARENA;
+}
+
+/*
+ * mesh_slot_of - the used slot holding addr, in addr's virtual page
+ */
+void *mesh_slot_of(const void *addr, size_t *size)
+{
+	size_t off, i;
+	struct mspan *s;
+	char *slot = NULL;
+
+	if (!mesh_owns(addr))
+		return NULL;
+	off = (char *)addr - mesh.base;
+	pthread_mutex_lock(&mesh.lock);
+	if (mesh.vmap[off >> MESH_PAGE_SHIFT] &&
+		(off & (MESH_PAGE_SIZE - 1)) >= MESH_SKIP) {
+		s = &mesh.spans[mesh.vmap[off >> MESH_PAGE_SHIFT] - 1];
+		i = ((off & (MESH_PAGE_SIZE - 1)) - MESH_SKIP) / s->size;
+		if (i < s->nslots && (s->map[i / 64] & (1UL << (i % 64)))) {
+			slot = mesh.base + (off & ~(MESH_PAGE_SIZE - 1)) + MESH_SKIP +
+			       i * s->size;
+			if (size)
+				*size = s->size;
+		}
+	}
+	pthread_mutex_unlock(&mesh.lock);
+	return slot;
+}
+
+/*
+ * mesh_compact - a meshing pass now
+ */
+size_t mesh_compact(void)
+{
+	size_t released = 0;
+
+	pthread_mutex_lock(&mesh.lock);
+	if (mesh.base)
+		released = compact((size_t)-1);
+	pthread_mutex_unlock(&mesh.lock);
+	return released;
+}
+
+void mesh_get_stats(struct mesh_stats *stats)
+{
+	pthread_mutex_lock(&mesh.lock);
+	stats->pages = mesh.pages;
+	stats->phys_pages = mesh.phys_pages;
+	stats->used_bytes = mesh.used_bytes;
+	stats->meshes = mesh.meshes;
+	stats->released = mesh.released;
+	pthread_mutex_unlock(&mesh.lock);
+}
+
+/*
+ * internal helper routines, mesh lock held
+ */
+
+/*
+ * mesh_setup - the file, its mapping, the tables, the SIGSEGV handler
+ * and the fork handlers
+ * return 0 if success, -1 if error
+ */
+static int mesh_setup(void)
+{
+	size_t meta = MESH_PAGES * (sizeof(unsigned int) * 3 + sizeof(struct mspan));
+	struct sigaction sa;
+	char *base, *p;
+	int fd;
+
+	if ((fd = memfd_create("mm-mesh", MFD_CLOEXEC)) == -1)
+		return -1;
+	if (ftruncate(fd, MESH_ARENA) == -1)
+		goto fail;
+	base = mmap(NULL, MESH_ARENA, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		goto fail;
+	p = mmap(NULL, meta, PROT_READ | PROT_WRITE,
+	         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		munmap(base, MESH_ARENA);
+		goto fail;
+	}
+	mesh.spans = (struct mspan *)p;
+	p += MESH_PAGES * sizeof(struct mspan);
+	mesh.vmap = (unsigned int *)p;
+	mesh.dirty = mesh.vmap + MESH_PAGES;
+	mesh.clean = mesh.dirty + MESH_PAGES;
+	mesh.fd = fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = mesh_fault;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &mesh.old_segv);
+	pthread_atfork(mesh_prepare, mesh_parent, mesh_child);
+	__atomic_store_n(&mesh.base, base, __ATOMIC_RELEASE);
+	return 0;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+/*
+ * span_new - a span for slots of size on a free page (resident ones
+ * first), put on the partial list
+ * return 0 if success, -1 if the arena is full
+ */
+static int span_new(size_t size)
+{
+	struct mspan *s;
+	unsigned int p;
+
+	if (mesh.ndirty)
+		p = mesh.dirty[--mesh.ndirty];
+	else if (mesh.nclean)
+		p = mesh.clean[--mesh.nclean];
+	else if (mesh.top < MESH_PAGES)
+		p = mesh.top++;
+	else
+		return -1;
+	s = &mesh.spans[p];
+	memset(s, 0, sizeof(*s));
+	s->size = size;
+	s->nslots = (MESH_PAGE_SIZE - MESH_SKIP) / size;
+	s->nvirt = 1;
+	s->virt[0] = p;
+	mesh.vmap[p] = p + 1;
+	mesh.pages++;
+	mesh.phys_pages++;
+	partial_insert(p);
+	return 0;
+}
+
+/*
+ * span_free - free an empty span: its own page becomes a dirty free
+ * page, its other virtual pages go back to their own file pages
+ */
+static void span_free(unsigned int p)
+{
+	struct mspan *s = &mesh.spans[p];
+	unsigned int k, v;
+
+	if (s->partial)
+		partial_remove(p);
+	for (k = 0; k < s->nvirt; k++) {
+		v = s->virt[k];
+		mesh.vmap[v] = 0;
+		mesh.pages--;
+		if (v == p) {
+			mesh.dirty[mesh.ndirty++] = v;
+			continue;
+		}
+		if (mmap(PAGE_ADDR(v), MESH_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		         MAP_SHARED | MAP_FIXED, mesh.fd,
+		         (off_t)v << MESH_PAGE_SHIFT) == MAP_FAILED)
+			continue; /* left on p's file page, never used again */
+		mesh.remapped--;
+		mesh.clean[mesh.nclean++] = v;
+	}
+	mesh.phys_pages--;
+}
+
+static void partial_insert(unsigned int p)
+{
+	struct mspan *s = &mesh.spans[p];
+	unsigned int *head = &mesh.partial[MESH_IDX(s->size)];
+
+	s->prev = 0;
+	s->next = *head;
+	if (*head)
+		mesh.spans[*head - 1].prev = p + 1;
+	*head = p + 1;
+	s->partial = 1;
+}
+
+static void partial_remove(unsigned int p)
+{
+	struct mspan *s = &mesh.spans[p];
+
+	if (s->prev)
+		mesh.spans[s->prev - 1].next = s->next;
+	else
+		mesh.partial[MESH_IDX(s->size)] = s->next;
+	if (s->next)
+		mesh.spans[s->next - 1].prev = s->prev;
+	s->partial = 0;
+}
+
+/*
+ * compact - a meshing pass over every size, up to budget meshes, then
+ * release the dirty free pages
+ * return the bytes released
+ */
+static size_t compact(size_t budget)
+{
+	size_t before = mesh.released;
+	int c;
+
+	for (c = 0; c < MESH_CLASSES && budget > 0; c++)
+		budget -= mesh_class(c, budget);
+	release_dirty();
+	return mesh.released - before;
+}
+
+/*
+ * mesh_class - mesh the spans of one size at most half used, window
+ * by window along the partial list
+ * 1. take the next MESH_CANDIDATES of them
+ * 2. try each with the next MESH_PROBES, the fuller one of a
+ *    meshable pair takes the other
+ * Meshing only takes spans of the window off the list, so the walk
+ * goes on after it. Return the meshes done, at most budget.
+ */
+static size_t mesh_class(int c, size_t budget)
+{
+	unsigned int cand[MESH_CANDIDATES];
+	struct mspan *a, *b;
+	unsigned int p = mesh.partial[c], n, i, j;
+	size_t done = 0;
+
+	while (p) {
+		for (n = 0; p && n < MESH_CANDIDATES; p = mesh.spans[p - 1].next)
+			if (mesh.spans[p - 1].used <= mesh.spans[p - 1].nslots / 2)
+				cand[n++] = p;
+		for (i = 0; i < n; i++) {
+			for (j = i + 1; cand[i] && j < n && j <= i + MESH_PROBES; j++) {
+				if (cand[j] == 0)
+					continue;
+				a = &mesh.spans[cand[i] - 1];
+				b = &mesh.spans[cand[j] - 1];
+				if (!meshable(a, b))
+					continue;
+				if (done == budget ||
+					mesh.remapped + MESH_ALIASES > MESH_REMAP_MAX)
+					return done;
+				if (b->used > a->used) {
+					if (mesh_pair(cand[j] - 1, cand[i] - 1) == 0) {
+						cand[i] = 0;
+						done++;
+					}
+					break;
+				}
+				if (mesh_pair(cand[i] - 1, cand[j] - 1) == 0) {
+					cand[j] = 0;
+					done++;
+				}
+				if (a->used > a->nslots / 2)
+					break;
+			}
+		}
+	}
+	return done;
+}
+
+/* meshable - no used slot in common and room for the virtual pages */
+static int meshable(struct mspan *a, struct mspan *b)
+{
+	unsigned int w;
+
+	if (a->nvirt + b->nvirt > MESH_ALIASES)
+		return 0;
+	for (w = 0; w < MESH_WORDS; w++)
+		if (a->map[w] & b->map[w])
+			return 0;
+	return 1;
+}
+
+/*
+ * mesh_pair - mesh span src into span dst
+ * writers to src's pages wait in mesh_fault from the write protection
+ * until their page is remapped (seq even again), then write to dst's
+ * file page
+ * return 0 if success, -1 if src could not be write protected
+ */
+static int mesh_pair(unsigned int dst, unsigned int src)
+{
+	struct mspan *d = &mesh.spans[dst], *s = &mesh.spans[src];
+	char *from = PAGE_ADDR(s->virt[0]) + MESH_SKIP;
+	char *to = PAGE_ADDR(d->virt[0]) + MESH_SKIP;
+	unsigned int i, k, v;
+	unsigned int w;
+
+	__atomic_fetch_add(&mesh.seq, 1, __ATOMIC_ACQ_REL);
+	for (k = 0; k < s->nvirt; k++) {
+		if (mprotect(PAGE_ADDR(s->virt[k]), MESH_PAGE_SIZE, PROT_READ) == -1) {
+			while (k-- > 0)
+				mprotect(PAGE_ADDR(s->virt[k]), MESH_PAGE_SIZE,
+				         PROT_READ | PROT_WRITE);
+			__atomic_fetch_add(&mesh.seq, 1, __ATOMIC_RELEASE);
+			return -1;
+		}
+	}
+	for (i = 0; i < s->nslots; i++)
+		if (s->map[i / 64] & (1UL << (i % 64)))
+			memcpy(to + i * s->size, from + i * s->size, s->size);
+	for (k = 0; k < s->nvirt; k++) {
+		v = s->virt[k];
+		if (mmap(PAGE_ADDR(v), MESH_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		         MAP_SHARED | MAP_FIXED, mesh.fd,
+		         (off_t)dst << MESH_PAGE_SHIFT) == MAP_FAILED) {
+			/* the page is read only over a file page about to go */
+			fprintf(stderr, "mm-mesh: cannot remap page %u\n", v);
+			abort();
+		}
+		mesh.vmap[v] = dst + 1;
+		d->virt[d->nvirt++] = v;
+		if (v == src) /* the others were remapped already */
+			mesh.remapped++;
+	}
+	__atomic_fetch_add(&mesh.seq, 1, __ATOMIC_RELEASE);
+
+	for (w = 0; w < MESH_WORDS; w++)
+		d->map[w] |= s->map[w];
+	d->used += s->used;
+	if (s->partial)
+		partial_remove(src);
+	if (d->used == d->nslots && d->partial)
+		partial_remove(dst);
+	punch(src);
+	mesh.phys_pages--;
+	mesh.meshes++;
+	return 0;
+}
+
+/* release_dirty - punch the free pages still in memory */
+static void release_dirty(void)
+{
+	unsigned int p;
+
+	while (mesh.ndirty) {
+		p = mesh.dirty[--mesh.ndirty];
+		punch(p);
+		mesh.clean[mesh.nclean++] = p;
+	}
+}
+
+/* punch - release file page p, it reads as zero afterwards */
+static void punch(unsigned int p)
+{
+	if (fallocate(mesh.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	              (off_t)p << MESH_PAGE_SHIFT, MESH_PAGE_SIZE) == 0)
+		mesh.released += MESH_PAGE_SIZE;
+}
+
+/*
+ * mesh_start - start the background thread, mesh lock held; again in
+ * a child after fork
+ */
+static void mesh_start(void)
+{
+	pthread_t tid;
+	pthread_attr_t attr;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&tid, &attr, mesh_thread, NULL) == 0)
+		mesh.worker = 1;
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * mesh_thread - background thread: every MESH_INTERVAL_MS with frees
+ * since the last pass, a pass of up to MESH_PASS_MAX meshes, the lock
+ * taken for MESH_SLICE of them at a time so that allocation goes on
+ * in between
+ */
+static void *mesh_thread(void *arg)
+{
+	struct timespec ts = {0, MESH_INTERVAL_MS * 1000000L};
+	unsigned long frees = 0, now;
+	size_t done, meshes;
+
+	(void)arg;
+	for (;;) {
+		nanosleep(&ts, NULL);
+		if ((now = __atomic_load_n(&mesh.frees, __ATOMIC_RELAXED)) == frees)
+			continue;
+		frees = now;
+		done = 0;
+		do {
+			pthread_mutex_lock(&mesh.lock);
+			meshes = mesh.meshes;
+			compact(MESH_SLICE);
+			meshes = mesh.meshes - meshes;
+			pthread_mutex_unlock(&mesh.lock);
+			done += meshes;
+		} while (meshes == MESH_SLICE && done < MESH_PASS_MAX);
+	}
+	return NULL;
+}
+
+/* the last arena fault of this thread, retried at meshing seq */
+static __thread const void *fault_addr;
+static __thread unsigned int fault_seq;
+
+/*
+ * mesh_fault - SIGSEGV handler: a fault in the arena is a write to a
+ * page being meshed, retried once the meshing is done. The meshing
+ * may have ended before the handler runs, so a fault in the arena is
+ * retried once without waiting; if it repeats with no meshing in
+ * between it is not ours. Other faults go to the old action; the
+ * default one is put back and the fault repeats with it.
+ */
+static void mesh_fault(int sig, siginfo_t *si, void *ctx)
+{
+	unsigned int seq;
+
+	if (mesh_owns(si->si_addr)) {
+		while ((seq = __atomic_load_n(&mesh.seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+		if (si->si_addr != fault_addr || seq != fault_seq) {
+			fault_addr = si->si_addr;
+			fault_seq = seq;
+			return;
+		}
+	}
+	if (mesh.old_segv.sa_flags & SA_SIGINFO)
+		mesh.old_segv.sa_sigaction(sig, si, ctx);
+	else if (mesh.old_segv.sa_handler != SIG_DFL &&
+	         mesh.old_segv.sa_handler != SIG_IGN)
+		mesh.old_segv.sa_handler(sig);
+	else
+		sigaction(SIGSEGV, &mesh.old_segv, NULL);
+}
+
+/*
+ * fork: no meshing or allocation across it, and the parent waits for
+ * the child's copy of the file before it goes on: until the child has
+ * remapped, a write of the parent to the shared file would show in the
+ * child's blocks. The child closing its end of the pipe wakes the
+ * parent; so does a failed fork, the parent closing its own.
+ */
+static void mesh_prepare(void)
+{
+	pthread_mutex_lock(&mesh.lock);
+	if (mesh.base == NULL || pipe2(mesh.fork_pipe, O_CLOEXEC) == -1)
+		mesh.fork_pipe[0] = mesh.fork_pipe[1] = -1;
+}
+
+static void mesh_parent(void)
+{
+	char c;
+
+	if (mesh.fork_pipe[0] != -1) {
+		close(mesh.fork_pipe[1]);
+		while (read(mesh.fork_pipe[0], &c, 1) == -1 && errno == EINTR)
+			;
+		close(mesh.fork_pipe[0]);
+	}
+	pthread_mutex_unlock(&mesh.lock);
+}
+
+/*
+ * mesh_child - the shared file would let parent and child write each
+ * other's blocks: copy the file pages in use to a new file and map
+ * the arena from it, aliases included, then let the parent go on
+ */
+static void mesh_child(void)
+{
+	char *copy;
+	size_t p;
+	int fd;
+
+	if (mesh.base == NULL) {
+		pthread_mutex_unlock(&mesh.lock);
+		return;
+	}
+	if (mesh.fork_pipe[0] != -1)
+		close(mesh.fork_pipe[0]);
+	fd = memfd_create("mm-mesh", MFD_CLOEXEC);
+	if (fd == -1 || ftruncate(fd, MESH_ARENA) == -1 ||
+		(copy = mmap(NULL, MESH_ARENA, PROT_READ | PROT_WRITE, MAP_SHARED,
+		             fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "mm-mesh: cannot copy the arena after fork\n");
+		abort();
+	}
+	for (p = 0; p < mesh.top; p++)
+		if (mesh.vmap[p] == p + 1)
+			memcpy(copy + (p << MESH_PAGE_SHIFT), PAGE_ADDR(p), MESH_PAGE_SIZE);
+	munmap(copy, MESH_ARENA);
+	mmap(mesh.base, MESH_ARENA, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	     fd, 0);
+	for (p = 0; p < mesh.top; p++)
+		if (mesh.vmap[p] && mesh.vmap[p] != p + 1)
+			mmap(PAGE_ADDR(p), MESH_PAGE_SIZE, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_FIXED, fd,
+			     (off_t)(mesh.vmap[p] - 1) << MESH_PAGE_SHIFT);
+	close(mesh.fd);
+	mesh.fd = fd;
+	mesh.worker = 0; /* not forked, the next free starts one */
+	if (mesh.fork_pipe[1] != -1)
+		close(mesh.fork_pipe[1]);
+	pthread_mutex_unlock(&mesh.lock);
+}
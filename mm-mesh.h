@@ -0,0 +1,85 @@
+/*
+ * mm-mesh.h
+ *
+ * Mesh arena: small blocks segregated by size onto pages of their own
+ * (one size per page, fixed slots), in a file (memfd) mapped into one
+ * reserved range. Pages of one size whose used slots do not overlap
+ * are meshed: the live slots of one are copied into the other and its
+ * virtual page is remapped onto the other's file page, so both
+ * virtual pages share one physical page and the file page left is
+ * released. Pointers into either page stay valid.
+ *
+ * Meshing runs on a background thread, started by the first free:
+ * every MESH_INTERVAL_MS with frees since, a pass taking the mesh lock
+ * for MESH_SLICE meshes at a time, so frees and allocations never mesh
+ * themselves. mesh_compact runs a whole pass on the caller's thread.
+ * A page being meshed is write protected while its slots are copied;
+ * a thread that writes to it waits in the SIGSEGV handler until the
+ * page is remapped, then its write goes to the shared page. Any other
+ * fault, in the arena or not, goes to the handler installed before.
+ * After fork, the child gets a copy of the file of its own, made
+ * before fork returns in the parent.
+ *
+ * Limits of the write barrier, which the application has to live with:
+ * - only user space writes fault: a system call writing into a slot
+ *   (read, recv, pread, ...) on a page being meshed fails with EFAULT
+ *   instead of waiting
+ * - the SIGSEGV handler is installed process wide on the first
+ *   mesh_alloc; if the application installs its own handler later
+ *   and does not chain to it, a write to a page being meshed kills
+ *   the process
+ * Meshing runs in the background at any time, so applications that
+ * do either must not use the arena.
+ *
+ * All calls are thread safe (one mesh lock).
+ */
+#ifndef MM_MESH_H
+#define MM_MESH_H
+
+#include <stddef.h>
+
+#define MESH_PAGE_SHIFT  12
+#define MESH_PAGE_SIZE   (1UL << MESH_PAGE_SHIFT)
+#define MESH_ARENA       (1UL << 30) /* reserved range and file size */
+#define MESH_MAX         256         /* largest slot size */
+#define MESH_INTERVAL_MS 100         /* background thread wake up interval */
+
+/*
+ * Slots start MESH_SKIP bytes into their page: a slot plus 4 (a block
+ * header) is 16-byte aligned, and so is every slot after it if the
+ * slot size is a multiple of 16
+ */
+#define MESH_SKIP 12
+
+struct mesh_stats {
+	size_t pages;        /* virtual pages holding slots */
+	size_t phys_pages;   /* file pages behind them */
+	size_t used_bytes;   /* bytes in used slots */
+	size_t meshes;       /* pages meshed so far */
+	size_t released;     /* bytes returned to the OS so far */
+};
+
+/*
+ * mesh_alloc - a slot of size bytes (a multiple of 8, 16 to MESH_MAX),
+ * NULL if the arena is full or cannot be set up
+ */
+void *mesh_alloc(size_t size);
+
+/* mesh_free - free the slot starting at slot */
+void mesh_free(void *slot);
+
+/* mesh_owns - whether addr is in the arena */
+int mesh_owns(const void *addr);
+
+/*
+ * mesh_slot_of - start of the used slot holding addr, NULL if none;
+ * stores the slot size in *size if not NULL
+ */
+void *mesh_slot_of(const void *addr, size_t *size);
+
+/* mesh_compact - mesh what can be meshed now, return the bytes released */
+size_t mesh_compact(void);
+
+void mesh_get_stats(struct mesh_stats *stats);
+
+#endif /* MM_MESH_H */
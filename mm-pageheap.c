@@ -0,0 +1,455 @@
+/*
+ * mm-pageheap.c
+ *
+ * Page heap (see mm-pageheap.h): spans of pages in one reservation
+ * made without swap reservation on first use. Pages are handed out
+ * from the bottom of the reservation (top marks the end of what was
+ * ever used), so the spans tile [0, top) and every span's neighbours
+ * are found through the page map:
+ * - a used span maps all its pages, so any address finds it
+ * - a free span maps its first and last page, enough for coalescing
+ *
+ * Free spans are on lists[n] if they are n < PH_CLASSES pages long,
+ * lists[0] otherwise (searched best fit). A free span is dirty if
+ * some of its pages may be in memory; once the dirty pages pass
+ * PH_DIRTY_MAX the largest dirty spans are released (MADV_DONTNEED),
+ * after which they are zero.
+ *
+ * Span structs come from their own mappings, kept on a spare list.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "mm-pageheap.h"
+
+#define PH_PAGES      (PH_RESERVE >> PH_PAGE_SHIFT)
+#define PH_META_CHUNK (64 << 10) /* span structs mapped at a time */
+
+#define PH_FREE 0
+#define PH_USED 1
+
+struct span {
+	size_t page;             /* first page, from the reservation start */
+	size_t npages;
+	int state;               /* PH_FREE or PH_USED */
+	int dirty;               /* free with pages maybe in memory */
+	int sizeclass;           /* used: the owner's class */
+	struct span *next, *prev; /* free list links, spare list */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	char *base;                      /* reservation, NULL until used */
+	struct span **pagemap;           /* page to span */
+	size_t top;                      /* pages ever handed out */
+	struct span *lists[PH_CLASSES];  /* free spans by length, [0] long */
+	struct span *spare;              /* span structs not in use */
+	size_t used, free, dirty, released; /* pages */
+	size_t used_spans, free_spans;
+} ph = { PTHREAD_MUTEX_INITIALIZER };
+
+static int ph_init(void);
+static struct span *span_new(void);
+static void span_put(struct span *s);
+static void list_insert(struct span *s);
+static void list_remove(struct span *s);
+static void map_ends(struct span *s);
+static void map_all(struct span *s);
+static struct span *find_span(size_t npages);
+static void carve(struct span *s, size_t npages, int sizeclass);
+static void span_release(struct span *s);
+static void scavenge(void);
+static void purge(struct span *s);
+
+/*
+ * ph_alloc - a used span of bytes rounded up to pages
+ * 1. the shortest free span that fits, the rest split off free
+ * 2. otherwise fresh pages from the top of the reservation
+ */
+void *ph_alloc(size_t bytes, int sizeclass, int *zero)
+{
+	size_t npages = (bytes + PH_PAGE_SIZE - 1) >> PH_PAGE_SHIFT;
+	struct span *s;
+
+	if (bytes == 0 || bytes > PH_RESERVE)
+		return NULL;
+	pthread_mutex_lock(&ph.lock);
+	if (ph.base == NULL && ph_init() == -1)
+		goto fail;
+	if ((s = find_span(npages)) != NULL) {
+		list_remove(s);
+		ph.free_spans--;
+	}
+	else {
+		if (npages > PH_PAGES - ph.top || (s = span_new()) == NULL)
+			goto fail;
+		s->page = ph.top;
+		s->npages = npages;
+		s->dirty = 0;
+		ph.top += npages;
+		ph.free += npages; /* counted free for carve */
+	}
+	if (zero)
+		*zero = !s->dirty;
+	carve(s, npages, sizeclass);
+	ph.used_spans++;
+	pthread_mutex_unlock(&ph.lock);
+	return ph.base + (s->page << PH_PAGE_SHIFT);
+
+fail:
+	pthread_mutex_unlock(&ph.lock);
+	return NULL;
+}
+
+/*
+ * ph_free - free a used span, coalescing it with free neighbours
+ */
+void ph_free(void *start)
+{
+	struct span *s;
+
+	if (start == NULL)
+		return;
+	pthread_mutex_lock(&ph.lock);
+	s = ph.pagemap[((char *)start - ph.base) >> PH_PAGE_SHIFT];
+	span_release(s);
+	pthread_mutex_unlock(&ph.lock);
+}
+
+/*
+ * ph_resize - resize a used span in place
+ * 1. shrink: the tail is split off and freed
+ * 2. grow: take the pages needed from the next span if it is free,
+ *    or from the top of the reservation if the span ends there
+ */
+int ph_resize(void *start, size_t bytes)
+{
+	size_t npages = (bytes + PH_PAGE_SIZE - 1) >> PH_PAGE_SHIFT;
+	size_t end, take;
+	struct span *s, *t;
+	int ret = 0;
+
+	if (npages == 0)
+		return -1;
+	pthread_mutex_lock(&ph.lock);
+	s = ph.pagemap[((char *)start - ph.base) >> PH_PAGE_SHIFT];
+	end = s->page + s->npages;
+	if (npages < s->npages) {
+		if ((t = span_new()) == NULL)
+			goto out; /* keep it whole, still correct */
+		t->page = s->page + npages;
+		t->npages = s->npages - npages;
+		t->state = PH_USED;
+		s->npages = npages;
+		ph.used_spans++;
+		span_release(t);
+	}
+	else if (npages > s->npages) {
+		take = npages - s->npages;
+		t = end < ph.top? ph.pagemap[end] : NULL;
+		if (t && t->state == PH_FREE && t->npages >= take) {
+			list_remove(t);
+			ph.free_spans--;
+			ph.free -= take;
+			if (t->dirty)
+				ph.dirty -= take;
+			if (t->npages > take) {
+				t->page += take;
+				t->npages -= take;
+				map_ends(t);
+				list_insert(t);
+				ph.free_spans++;
+			}
+			else
+				span_put(t);
+		}
+		else if (end == ph.top && take <= PH_PAGES - ph.top)
+			ph.top += take;
+		else {
+			ret = -1;
+			goto out;
+		}
+		s->npages = npages;
+		ph.used += take;
+		map_all(s);
+	}
+out:
+	pthread_mutex_unlock(&ph.lock);
+	return ret;
+}
+
+/*
+ * ph_span_of - the used span holding addr
+ */
+void *ph_span_of(const void *addr, size_t *len, int *sizeclass)
+{
+	const char *p = addr;
+	struct span *s = NULL;
+	size_t page;
+
+	pthread_mutex_lock(&ph.lock);
+	if (ph.base && p >= ph.base && p < ph.base + (ph.top << PH_PAGE_SHIFT)) {
+		page = (p - ph.base) >> PH_PAGE_SHIFT;
+		s = ph.pagemap[page];
+		if (s && (s->state != PH_USED || page < s->page ||
+			page >= s->page + s->npages))
+			s = NULL;
+		if (s && len)
+			*len = s->npages << PH_PAGE_SHIFT;
+		if (s && sizeclass)
+			*sizeclass = s->sizeclass;
+	}
+	pthread_mutex_unlock(&ph.lock);
+	return s? ph.base + (s->page << PH_PAGE_SHIFT) : NULL;
+}
+
+/*
+ * ph_release - return every dirty free span to the OS
+ */
+size_t ph_release(void)
+{
+	struct span *s;
+	size_t before;
+	int i;
+
+	pthread_mutex_lock(&ph.lock);
+	before = ph.released;
+	for (i = 0; i < PH_CLASSES; i++)
+		for (s = ph.lists[i]; s; s = s->next)
+			if (s->dirty)
+				purge(s);
+	before = ph.released - before;
+	pthread_mutex_unlock(&ph.lock);
+	return before << PH_PAGE_SHIFT;
+}
+
+void ph_get_stats(struct ph_stats *stats)
+{
+	pthread_mutex_lock(&ph.lock);
+	stats->reserved_bytes = ph.base? PH_RESERVE : 0;
+	stats->top_bytes = ph.top << PH_PAGE_SHIFT;
+	stats->used_bytes = ph.used << PH_PAGE_SHIFT;
+	stats->free_bytes = ph.free << PH_PAGE_SHIFT;
+	stats->dirty_bytes = ph.dirty << PH_PAGE_SHIFT;
+	stats->released_bytes = ph.released << PH_PAGE_SHIFT;
+	stats->used_spans = ph.used_spans;
+	stats->free_spans = ph.free_spans;
+	pthread_mutex_unlock(&ph.lock);
+}
+
+/*
+ * internal helper routines, page heap lock held
+ */
+
+/*
+ * ph_init - reserve the pages and the page map
+ * return 0 if success, -1 if error
+ */
+static int ph_init(void)
+{
+	char *base, *map;
+
+	base = mmap(NULL, PH_RESERVE, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED)
+		return -1;
+	map = mmap(NULL, PH_PAGES * sizeof(struct span *), PROT_READ | PROT_WRITE,
+	           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (map == MAP_FAILED) {
+		munmap(base, PH_RESERVE);
+		return -1;
+	}
+	ph.pagemap = (struct span **)map;
+	ph.base = base;
+	return 0;
+}
+
+/* span_new - a span struct from the spare list, mapping more if empty */
+static struct span *span_new(void)
+{
+	struct span *s;
+	size_t i;
+
+	if (ph.spare == NULL) {
+		s = mmap(NULL, PH_META_CHUNK, PROT_READ | PROT_WRITE,
+		         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (s == MAP_FAILED)
+			return NULL;
+		for (i = 0; i < PH_META_CHUNK / sizeof(*s); i++)
+			span_put(&s[i]);
+	}
+	s = ph.spare;
+	ph.spare = s->next;
+	memset(s, 0, sizeof(*s));
+	return s;
+}
+
+static void span_put(struct span *s)
+{
+	s->next = ph.spare;
+	ph.spare = s;
+}
+
+/* list_insert - push a free span on the list for its length */
+static void list_insert(struct span *s)
+{
+	struct span **head = &ph.lists[s->npages < PH_CLASSES? s->npages : 0];
+
+	s->prev = NULL;
+	s->next = *head;
+	if (*head)
+		(*head)->prev = s;
+	*head = s;
+}
+
+static void list_remove(struct span *s)
+{
+	struct span **head = &ph.lists[s->npages < PH_CLASSES? s->npages : 0];
+
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		*head = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+}
+
+/* map_ends - map the first and last page of s */
+static void map_ends(struct span *s)
+{
+	ph.pagemap[s->page] = s;
+	ph.pagemap[s->page + s->npages - 1] = s;
+}
+
+/* map_all - map every page of s */
+static void map_all(struct span *s)
+{
+	size_t i;
+
+	for (i = 0; i < s->npages; i++)
+		ph.pagemap[s->page + i] = s;
+}
+
+/*
+ * find_span - the shortest free span of at least npages: the first on
+ * the exact lists from npages up, else best fit on the long list
+ */
+static struct span *find_span(size_t npages)
+{
+	struct span *s, *best = NULL;
+	size_t i;
+
+	for (i = npages; i < PH_CLASSES; i++)
+		if (ph.lists[i])
+			return ph.lists[i];
+	for (s = ph.lists[0]; s; s = s->next)
+		if (s->npages >= npages && (best == NULL || s->npages < best->npages))
+			best = s;
+	return best;
+}
+
+/*
+ * carve - make the first npages of the free span s (off its list) a
+ * used span, the rest a free span on its list
+ */
+static void carve(struct span *s, size_t npages, int sizeclass)
+{
+	struct span *rest;
+
+	if (s->npages > npages && (rest = span_new()) != NULL) {
+		rest->page = s->page + npages;
+		rest->npages = s->npages - npages;
+		rest->state = PH_FREE;
+		rest->dirty = s->dirty;
+		map_ends(rest);
+		list_insert(rest);
+		ph.free_spans++;
+		s->npages = npages;
+	}
+	ph.free -= s->npages;
+	ph.used += s->npages;
+	if (s->dirty)
+		ph.dirty -= s->npages;
+	s->state = PH_USED;
+	s->dirty = 0;
+	s->sizeclass = sizeclass;
+	map_all(s);
+}
+
+/*
+ * span_release - turn a used span free and merge it with free
+ * neighbours; the merged span is dirty. Then keep the dirty pages
+ * within PH_DIRTY_MAX.
+ */
+static void span_release(struct span *s)
+{
+	struct span *n;
+	size_t end;
+
+	ph.used -= s->npages;
+	ph.free += s->npages;
+	ph.dirty += s->npages;
+	ph.used_spans--;
+	s->state = PH_FREE;
+	s->dirty = 1;
+
+	if (s->page > 0 && (n = ph.pagemap[s->page - 1])->state == PH_FREE) {
+		list_remove(n);
+		ph.free_spans--;
+		if (!n->dirty)
+			ph.dirty += n->npages;
+		s->page = n->page;
+		s->npages += n->npages;
+		span_put(n);
+	}
+	end = s->page + s->npages;
+	if (end < ph.top && (n = ph.pagemap[end])->state == PH_FREE) {
+		list_remove(n);
+		ph.free_spans--;
+		if (!n->dirty)
+			ph.dirty += n->npages;
+		s->npages += n->npages;
+		span_put(n);
+	}
+	map_ends(s);
+	list_insert(s);
+	ph.free_spans++;
+	if (ph.dirty > (PH_DIRTY_MAX >> PH_PAGE_SHIFT))
+		scavenge();
+}
+
+/*
+ * scavenge - release the largest dirty free spans until the dirty
+ * pages are down to half of PH_DIRTY_MAX
+ */
+static void scavenge(void)
+{
+	struct span *s, *big;
+	int i;
+
+	while (ph.dirty > (PH_DIRTY_MAX >> PH_PAGE_SHIFT) / 2) {
+		big = NULL;
+		for (s = ph.lists[0]; s; s = s->next)
+			if (s->dirty && (big == NULL || s->npages > big->npages))
+				big = s;
+		for (i = PH_CLASSES - 1; big == NULL && i > 0; i--)
+			for (s = ph.lists[i]; s && big == NULL; s = s->next)
+				if (s->dirty)
+					big = s;
+		if (big == NULL)
+			break;
+		purge(big);
+	}
+}
+
+/* purge - return a dirty free span's pages to the OS */
+static void purge(struct span *s)
+{
+	madvise(ph.base + (s->page << PH_PAGE_SHIFT), s->npages << PH_PAGE_SHIFT,
+	        MADV_DONTNEED);
+	s->dirty = 0;
+	ph.dirty -= s->npages;
+	ph.released += s->npages;
+}
@@ -0,0 +1,69 @@
+/*
+ * mm-pageheap.h
+ *
+ * Page heap: runs of pages (spans) carved from one reserved address
+ * range, for the allocator's page-granular memory (mm.c with PAGEHEAP
+ * gets its mapped blocks here). Free spans are coalesced with their
+ * free neighbours through a page map and kept on lists by length:
+ * one list per length below PH_CLASSES pages, one for the rest. Free
+ * spans stay in memory (dirty) up to a limit, beyond which the
+ * largest are returned to the OS; returned spans read as zero.
+ *
+ * A used span carries a size class (0 for a large block), so a slab
+ * layer could find its span and class from any address in it. No
+ * such layer exists yet: the only user is mm.c built with PAGEHEAP,
+ * for its mapped blocks (class 0). Small blocks stay in the heap, or
+ * in the mesh arena's own file with MESH.
+ * All calls are thread safe (one page heap lock).
+ */
+#ifndef MM_PAGEHEAP_H
+#define MM_PAGEHEAP_H
+
+#include <stddef.h>
+
+#define PH_PAGE_SHIFT 12
+#define PH_PAGE_SIZE  (1UL << PH_PAGE_SHIFT)
+#define PH_CLASSES    128          /* exact lists for 1..127 pages */
+#define PH_RESERVE    (1UL << 36)  /* address space reserved, 64 GB */
+#define PH_DIRTY_MAX  (64UL << 20) /* free bytes kept in memory */
+
+struct ph_stats {
+	size_t reserved_bytes; /* address space reserved */
+	size_t top_bytes;      /* bytes of it ever handed out */
+	size_t used_bytes;     /* in used spans */
+	size_t free_bytes;     /* in free spans */
+	size_t dirty_bytes;    /* free and still in memory */
+	size_t released_bytes; /* returned to the OS so far */
+	size_t used_spans;
+	size_t free_spans;
+};
+
+/*
+ * ph_alloc - a span of at least bytes (rounded up to pages), NULL if
+ * the reservation is exhausted. *zero (if not NULL) is set if the
+ * span is known zero.
+ */
+void *ph_alloc(size_t bytes, int sizeclass, int *zero);
+
+/* ph_free - free the used span starting at start */
+void ph_free(void *start);
+
+/*
+ * ph_resize - resize the used span at start to bytes in place,
+ * shrinking always works, growing takes from a free next span
+ * return 0 if success, -1 if it cannot grow in place
+ */
+int ph_resize(void *start, size_t bytes);
+
+/*
+ * ph_span_of - start of the used span holding addr, NULL if none;
+ * stores its length in *len and class in *sizeclass if not NULL
+ */
+void *ph_span_of(const void *addr, size_t *len, int *sizeclass);
+
+/* ph_release - return all free spans to the OS, return the bytes */
+size_t ph_release(void);
+
+void ph_get_stats(struct ph_stats *stats);
+
+#endif /* MM_PAGEHEAP_H */
@@ -0,0 +1,74 @@
+/*
+ * mm-ref32.h
+ *
+ * Compressed references: a heap object named by a 32-bit offset from
+ * the heap base instead of a 64-bit pointer, scaled by the 8-byte
+ * payload alignment. The heap never grows past 4 GB (the free list
+ * links are 32-bit offsets too), so every heap payload has a
+ * reference; converting back is one shift-and-add off mm_ref_base.
+ *
+ * Only blocks from the heap have references: mapped blocks (requests
+ * of mmap_threshold and up) do not. mm_malloc32 always allocates from
+ * the heap; realloc may move a block out of it once it gets large.
+ * Reference 0 is NULL, the heap base itself is never a payload.
+ */
+#ifndef MM_REF32_H
+#define MM_REF32_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "mm.h"
+
+#define MM_REF_SHIFT 3 /* payloads and their fields are 8-aligned */
+
+typedef uint32_t mm_ref32_t;
+
+extern char *mm_ref_base;  /* heap base, set by mm_init */
+extern void *mm_malloc32(size_t size);
+
+/* reference of p, an 8-aligned address inside a heap block, or NULL */
+static inline mm_ref32_t mm_ref32(const void *p)
+{
+	return p? (mm_ref32_t)(((const char *)p - mm_ref_base) >> MM_REF_SHIFT)
+	        : 0;
+}
+
+/* pointer named by ref */
+static inline void *mm_deref32(mm_ref32_t ref)
+{
+	return ref? mm_ref_base + ((size_t)ref << MM_REF_SHIFT) : NULL;
+}
+#ifdef __cplusplus
+}
+
+/*
+ * mm_ref<T> - a 4-byte T*, for pointer-rich structures:
+ * struct node { mm_ref<node> left, right; };
+ */
+template <class T>
+class mm_ref {
+public:
+	mm_ref() : ref_(0) {}
+	mm_ref(T *p) : ref_(mm_ref32(p)) {}
+	static mm_ref from_raw(mm_ref32_t ref) { mm_ref r; r.ref_ = ref; return r; }
+
+	T *get() const { return static_cast<T *>(mm_deref32(ref_)); }
+	T *operator->() const { return get(); }
+	T &operator*() const { return *get(); }
+	operator T *() const { return get(); }
+	mm_ref32_t raw() const { return ref_; }
+
+	friend bool operator==(mm_ref a, mm_ref b) { return a.ref_ == b.ref_; }
+	friend bool operator!=(mm_ref a, mm_ref b) { return a.ref_ != b.ref_; }
+
+private:
+	mm_ref32_t ref_;
+};
+
+static_assert(sizeof(mm_ref<int>) == 4, "mm_ref must stay 32-bit");
+#endif /* __cplusplus */
+
+#endif /* MM_REF32_H */
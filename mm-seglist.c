@@ -23,15 +23,28 @@
  *
  * Size classes (orgnized by free block size in bytes):
  * [2^4~2^5), [2^5~2^6), ..., [2^19~2^20), [2^20, inf]
+ *
+ * With TBINS, threads keep small blocks in bins of their own and move
+ * them to and from the shared lists in batches (see below).
+ * With AFREE, larger frees are only queued; they reach the free lists
+ * later in address order.
  */
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "mm.h"
+#include "mm-engine.h"
 #include "memlib.h"
+#include "mm-core.h"
+
+#ifdef ALIGN16
+#error "mm-seglist.c keeps 8-byte alignment, ALIGN16 is mm.c only"
+#endif
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
@@ -52,23 +65,30 @@
 #define calloc mm_calloc
 #endif /* def DRIVER */
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
-
-/* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
-
-/* Basic constants and macros */
-#define WSIZE       4       /* Word and header/footer size (bytes) */
-#define DSIZE       8       /* Doubleword size (bytes) */
-#define CHUNKSIZE  (1<<12)  /* Extend heap by this amount (bytes) */
-#define MIN_BLK_SIZE 16 /* minimum block size (bytes) */ 
+/*
+ * With MM_ENGINES this is the "seg" engine behind mm-engine.c, which
+ * owns the entry points: ours get a seg_ prefix.
+ */
+#ifdef MM_ENGINES
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+#define mm_init seg_init
+#define malloc seg_malloc
+#define free seg_free
+#define realloc seg_realloc
+#define calloc seg_calloc
+#define mm_checkheap seg_checkheap
+#define mm_block_of seg_block_of
+#define mm_heap_stats(...) seg_heap_stats(__VA_ARGS__) /* not the struct tag */
+#endif /* def MM_ENGINES */
+
+/* Constants and macros beyond those of mm-core.h */
 #define NUM_SIZES 17 /* number of size classes */
 #define MIN_PWR 4 /* power of 2 for the minimum size class */
 #define MAX_PWR 20 /* power of 2 for the maximum size class */
 
-#define MAX(x, y) ((x) > (y)? (x) : (y))  
-
 /* Pack a size and allocated bit into a word */
 /* last 2 bits: 0x1 -- prev free, curr alloc */
 /*              0x2 -- prev alloc, curr free */
@@ -76,23 +96,9 @@
 /*              0x0 -- prev free, curr free  */
 #define PACK(size, prev_alloc, alloc)  ((size) | (prev_alloc << 1) | (alloc)) 
 
-/* Read and write a word at address p */
-#define GET(p)       (*(unsigned int *)(p))            
-#define PUT(p, val)  (*(unsigned int *)(p) = (val))    
-
-/* Read the size and allocated fields from address p */
-#define GET_SIZE(p)  (GET(p) & ~0x7)                   
-#define GET_ALLOC(p) (GET(p) & 0x1)
+/* Read the previous block's allocated field from address p */
 #define GET_PREV_ALLOC(p) ((GET(p) & 0x2) >> 1)                 
 
-/* Given block ptr bp, compute address of its header and footer */
-#define HDRP(bp)       ((char *)(bp) - WSIZE)                     
-#define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) 
-
-/* Given block ptr bp, compute address of next and previous blocks */
-#define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
-#define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
-
 /* Read and write a pointer at an address (64-bit) */
 #define GET_PTR(addr) ((void *)(*(long *)(addr)))
 #define PUT_PTR(addr, ptr) (*(long *)(addr) = (long)ptr)
@@ -100,12 +106,106 @@
 /* Get the payload a block can provide */
 #define GET_PAYLOAD(bp) (GET_SIZE(HDRP(bp)) - WSIZE)
 
+/*
+ * Define TBINS for threads: the shared lists go under one heap lock and
+ * every thread keeps freed small blocks (up to TB_MAX bytes) in bins of
+ * its own, one per block size, that it allocates from without locking.
+ * Bins refill and drain a batch of TB_BATCH blocks at a time, linked
+ * through their first payload word:
+ * - a bin that runs empty takes a batch from the transfer cache with
+ *   one CAS, or allocates one from the shared lists under one lock
+ * - a bin that reaches 2 * TB_BATCH blocks passes its oldest batch to
+ *   the transfer cache, or frees it to the shared lists under one lock
+ *   if the cache is full
+ * The transfer cache is a lock-free stack of batches per block size,
+ * linked through the second payload word of their first block, with a
+ * tagged head as mm.c's small stacks. Blocks in bins and batches stay
+ * allocated in the heap. A thread's bins are freed when it exits and
+ * dropped when mm_init starts a new heap.
+ */
+#define TBINSx
+
+#define TB_MAX     256 /* largest block size kept in a bin */
+#define TB_CLASSES ((TB_MAX - MIN_BLK_SIZE) / DSIZE + 1)
+#define TB_IDX(size) (((size) - MIN_BLK_SIZE) / DSIZE)
+#define TB_BATCH   32  /* blocks moved at a time */
+#define TC_BATCHES 16  /* max batches per block size in the transfer cache */
+
+/* transfer cache head: offset of the top batch, version in the high half */
+#define HEAD_OFF(head) ((unsigned int)(head))
+#define HEAD_VER(head) ((unsigned int)((head) >> 32))
+#define MAKE_HEAD(off, ver) (((unsigned long)(ver) << 32) | (off))
+
+/*
+ * Define AFREE (with TBINS) to take coalescing off the freeing thread:
+ * free of a block above TB_MAX only links it into a buffer of the
+ * thread's own (one store through the block), and once the buffer
+ * holds AF_BATCH blocks or AF_MAX_BYTES bytes it is passed to a shared
+ * list of pending buffers with one CAS. Pending blocks are freed under
+ * one lock, sorted by address so that a run of adjacent blocks is
+ * merged first and coalesced with its neighbours once: by a background
+ * thread every AF_INTERVAL_MS, and by the next malloc that takes the
+ * heap lock, which passes on its own thread's buffer first, however
+ * full. Pending blocks stay allocated in the heap until then. A thread's buffer is passed on
+ * when it exits and dropped when mm_init starts a new heap.
+ * mm-stress.c builds with TBINS and AFREE on and runs both under
+ * threads.
+ */
+#define AFREEx
+
+#define AF_BATCH       64   /* blocks in a thread's buffer before it is passed */
+#define AF_MAX_BYTES   (256<<10) /* bytes in a thread's buffer before it is passed */
+#define AF_SORT_MAX    4096 /* blocks sorted at a time */
+#define AF_INTERVAL_MS 10   /* background thread wake up interval */
+
+#if defined(AFREE) && !defined(TBINS)
+#error "AFREE needs TBINS (the heap lock and thread state)"
+#endif
+
+#ifdef TBINS
+#define HEAP_LOCK()   pthread_mutex_lock(&heap_lock)
+#define HEAP_UNLOCK() pthread_mutex_unlock(&heap_lock)
+#else
+#define HEAP_LOCK()
+#define HEAP_UNLOCK()
+#endif
+
 /* Global variables */
 static void *heap_listp = 0;
 static void *free_lists_base = 0;
 static void *free_lists_end = 0;
 
+#ifdef TBINS
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* a thread's bin: offset of the newest block, 0 if empty */
+struct tbin {
+	unsigned int head;
+	unsigned int count;
+};
+static __thread struct tbin tbins[TB_CLASSES];
+static __thread unsigned int tbins_gen; /* heap the bins belong to */
+static unsigned int heap_gen = 1;       /* bumped by mm_init */
+static unsigned long tc_head[TB_CLASSES];
+static unsigned int tc_count[TB_CLASSES]; /* approximate depth */
+static pthread_key_t tbins_key;         /* frees the bins at thread exit */
+static pthread_once_t tbins_once = PTHREAD_ONCE_INIT;
+#endif /* def TBINS */
+
+#ifdef AFREE
+/* a thread's buffer: blocks linked through their first payload word */
+static __thread unsigned int af_head, af_count;
+static __thread size_t af_bytes;
+/* pending buffers, linked through the second word of their first block */
+static unsigned int af_pending;
+static unsigned int af_sorted[AF_SORT_MAX]; /* heap lock held */
+static pthread_once_t af_once = PTHREAD_ONCE_INIT;
+#endif /* def AFREE */
+
 /* Function prototypes for internal helper routines */
+static int heap_init(void);
+static void *alloc_block(size_t asize);
+static void free_block(void *bp);
 static void *extend_heap(size_t words);
 static void *coalesce(void *bp);
 static void place(void *bp, size_t asize);
@@ -122,12 +222,49 @@ static size_t mm_log2(size_t n);
 static void printHeap(int lineno);
 static void printLists(int lineno);
 static void printRaw(int lineno);
-static int in_heap(const void *p);
+static void check_locked(int lineno);
+#ifdef TBINS
+/* Thread bins and the transfer cache */
+static struct tbin *tb_get(void);
+static void tb_key_create(void);
+static void tb_exit(void *bins);
+static void *tb_alloc(size_t asize);
+static void tb_free(void *bp, size_t size);
+static int tb_refill(struct tbin *bin, size_t asize);
+static void tb_drain(struct tbin *bin, int cls);
+static unsigned int tc_pop(int cls);
+static int tc_push(int cls, unsigned int batch);
+static void free_chain(unsigned int off);
+#endif /* def TBINS */
+#ifdef AFREE
+/* Queued frees */
+static void af_free(void *bp);
+static void af_flush(void);
+static void af_drain(void);
+static void af_free_sorted(unsigned int *off, unsigned int n);
+static int af_cmp(const void *a, const void *b);
+static void af_start(void);
+static void *af_thread(void *arg);
+#endif /* def AFREE */
 /*
  * Initialize: return -1 on error, 0 on success.
- * Initial heap: 17 size class pointers + proplogue + epilogue
+ * Under the heap lock: the AFREE background thread drains under it,
+ * and must not walk the heap while a new one is set up.
  */
 int mm_init(void) {
+	int ret;
+
+	HEAP_LOCK();
+	ret = heap_init();
+	HEAP_UNLOCK();
+	return ret;
+}
+
+/*
+ * Initial heap: 17 size class pointers + proplogue + epilogue,
+ * heap lock held
+ */
+static int heap_init(void) {
 	int i;
 	void *bp;
 
@@ -141,6 +278,9 @@ int mm_init(void) {
 		heap_listp += DSIZE;
 	}
 	free_lists_end = heap_listp;
+	/* Block start index for mm_block_of, offsets from the heap start */
+	if (idx_init(free_lists_base, 0x100000000UL) == -1)
+		return -1;
 
 	/* Add prologue and epilogue */
 	PUT(heap_listp, 0); /* Zero padding */
@@ -153,6 +293,15 @@ int mm_init(void) {
 	if ((bp = extend_heap(CHUNKSIZE/WSIZE)) == NULL)
 		return -1;
 
+#ifdef TBINS
+	/* blocks held in bins and batches were in the old heap */
+	memset(tc_head, 0, sizeof(tc_head));
+	memset(tc_count, 0, sizeof(tc_count));
+#ifdef AFREE
+	__atomic_store_n(&af_pending, 0, __ATOMIC_RELAXED);
+#endif
+	__atomic_fetch_add(&heap_gen, 1, __ATOMIC_RELEASE);
+#endif
     return 0;
 }
 
@@ -163,12 +312,21 @@ int mm_init(void) {
  */
 void *malloc (size_t size) {
 	size_t asize; /* Adjusted block size */
-	size_t extendsize; /* Amount to extend heap if no fit found */
 	void *bp;
+	int ret = 0;
 
 	/* Ignore spurious requests */
 	if (size == 0)
 		return NULL;
+	/* First use of the heap */
+	if (heap_listp == 0) {
+		HEAP_LOCK();
+		if (heap_listp == 0)
+			ret = heap_init();
+		HEAP_UNLOCK();
+		if (ret == -1)
+			return NULL;
+	}
 
 	/* Adjust block size to include overhead and alignment reqs */
 	if (size <= (DSIZE + WSIZE))
@@ -176,18 +334,13 @@ void *malloc (size_t size) {
 	else
 		asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
 
-	/* Search free lists for a fit */
-	if ((bp = find_fit(asize)) != NULL) {
-		place(bp, asize);
-		return bp;
-	}
-
-	/* No fit. Ask more heap memory from OS */
-	extendsize = MAX(asize, CHUNKSIZE);
-	if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
-		return NULL;
-	place(bp, asize);
-
+#ifdef TBINS
+	if (asize <= TB_MAX)
+		return tb_alloc(asize);
+#endif
+	HEAP_LOCK();
+	bp = alloc_block(asize);
+	HEAP_UNLOCK();
 	return bp;
 }
 
@@ -195,24 +348,22 @@ void *malloc (size_t size) {
  * free a block at given ptr
  */
 void free (void *bp) {
-	void *next_bp_hdrp;
-
 	if (bp == 0)
 		return;
 
-	/* get the allocated block size */
-	size_t size = GET_SIZE(HDRP(bp));
-
-	/* free the block */
-	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)), 0));
-	PUT(FTRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)), 0));
-	/* set next block's prev_alloc state to 0 */
-	next_bp_hdrp = HDRP(NEXT_BLKP(bp));
-	PUT(next_bp_hdrp, GET(next_bp_hdrp) & ~0x2);
-
-	/* coalesce with any ajacent blocks */
-	bp = coalesce(bp);
-
+#ifdef TBINS
+	if (GET_SIZE(HDRP(bp)) <= TB_MAX) {
+		tb_free(bp, GET_SIZE(HDRP(bp)));
+		return;
+	}
+#endif
+#ifdef AFREE
+	af_free(bp);
+	return;
+#endif
+	HEAP_LOCK();
+	free_block(bp);
+	HEAP_UNLOCK();
 }
 
 /*
@@ -263,10 +414,96 @@ void *calloc (size_t nmemb, size_t size) {
     return ptr;
 }
 
+/*
+ * mm_block_of - the allocated block containing addr, header included
+ * return its payload and store the usable size in *size (if size is
+ * not NULL), NULL if addr is in no allocated block
+ */
+void *mm_block_of(const void *addr, size_t *size) {
+	char *p = (char *)addr;
+	char *bp;
+
+	HEAP_LOCK();
+	if (heap_listp == 0 || p <= (char *)heap_listp || p > (char *)mem_heap_hi())
+		bp = NULL;
+	else
+		bp = idx_find(p + WSIZE);
+	if (bp == NULL || !GET_ALLOC(HDRP(bp)) || 
+		p >= HDRP(bp) + GET_SIZE(HDRP(bp)))
+		bp = NULL;
+	else if (size)
+		*size = GET_PAYLOAD(bp);
+	HEAP_UNLOCK();
+	return bp;
+}
+
+/*
+ * mm_heap_stats - heap size and free blocks (blocks held in thread
+ * bins and the transfer cache, and queued frees, count as allocated)
+ */
+void mm_heap_stats(struct mm_heap_stats *stats) {
+	HEAP_LOCK();
+	core_heap_stats(heap_listp, stats);
+	HEAP_UNLOCK();
+}
+
 /*
  * internal helper routines 
  */
 
+/*
+ * allocate a block of asize bytes from the free lists, or from new
+ * heap memory if no block fits. Heap lock held with TBINS.
+ */
+static void *alloc_block(size_t asize) {
+	size_t extendsize; /* Amount to extend heap if no fit found */
+	void *bp;
+
+#ifdef AFREE
+	/* queued frees first, this thread's too: they may hold the fit */
+	if (af_head) {
+		tb_get(); /* drops a buffer of an older heap */
+		if (af_head)
+			af_flush();
+	}
+	if (__atomic_load_n(&af_pending, __ATOMIC_RELAXED))
+		af_drain();
+#endif
+	/* Search free lists for a fit */
+	if ((bp = find_fit(asize)) != NULL) {
+		place(bp, asize);
+		return bp;
+	}
+
+	/* No fit. Ask more heap memory from OS */
+	extendsize = MAX(asize, CHUNKSIZE);
+	if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+		return NULL;
+	place(bp, asize);
+
+	return bp;
+}
+
+/*
+ * free an allocated block to the free lists. Heap lock held with TBINS.
+ */
+static void free_block(void *bp) {
+	void *next_bp_hdrp;
+
+	/* get the allocated block size */
+	size_t size = GET_SIZE(HDRP(bp));
+
+	/* free the block */
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)), 0));
+	PUT(FTRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)), 0));
+	/* set next block's prev_alloc state to 0 */
+	next_bp_hdrp = HDRP(NEXT_BLKP(bp));
+	PUT(next_bp_hdrp, GET(next_bp_hdrp) & ~0x2);
+
+	/* coalesce with any ajacent blocks */
+	coalesce(bp);
+}
+
 /*
  * extend the heap by words by asking the OS
  * return pointer to the paged-in coalesced free block of size requested
@@ -286,6 +523,7 @@ static void *extend_heap(size_t words) {
 	PUT(FTRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)), 0));
 	/* new epilogue header */ 
 	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 1));
+	idx_set(bp);
 
 	/* Coalesce if previous block is free */
 	return coalesce(bp);
@@ -312,6 +550,7 @@ static void *coalesce(void *bp) {
 		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
 		/* delete next block from its list */
 		deleteBlk(NEXT_BLKP(bp));
+		idx_clear(NEXT_BLKP(bp));
 		/* coalesce with next */
 		PUT(HDRP(bp), PACK(size, 1, 0));
 		PUT(FTRP(bp), PACK(size, 1, 0));
@@ -321,6 +560,7 @@ static void *coalesce(void *bp) {
 		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
 		/* delete prev block from its list */
 		deleteBlk(PREV_BLKP(bp));
+		idx_clear(bp);
 		/* coalesce with prev */
 		PUT(FTRP(bp), PACK(size, 1, 0));
 		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 1, 0));
@@ -333,6 +573,8 @@ static void *coalesce(void *bp) {
 		/* detele prev and next free blocks from their lists */
 		deleteBlk(NEXT_BLKP(bp));
 		deleteBlk(PREV_BLKP(bp));
+		idx_clear(NEXT_BLKP(bp));
+		idx_clear(bp);
 		/* coalesce with both sides */
 		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 1, 0));
 		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 1, 0));
@@ -446,6 +688,7 @@ static void place(void *bp, size_t asize) {
 		bp = NEXT_BLKP(bp);
 		PUT(HDRP(bp), PACK(csize-asize, 1, 0));
 		PUT(FTRP(bp), PACK(csize-asize, 1, 0));
+		idx_set(bp);
 		/* insert splitted free block back to appropriate list */
 		insertBlk(bp);
 	} 
@@ -500,28 +743,332 @@ static void *get_next_free_bp(void *bp) {
 	return itop(GET(bp + WSIZE));
 }
 
+#ifdef TBINS
+/*
+ * thread bins and the transfer cache
+ */
+
 /*
- * Return whether the pointer is in the heap.
- * May be useful for debugging.
+ * this thread's bins, emptied if they hold blocks of an older heap
  */
-static int in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+static struct tbin *tb_get(void) {
+	unsigned int gen = __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE);
+
+	if (tbins_gen != gen) {
+		memset(tbins, 0, sizeof(tbins));
+#ifdef AFREE
+		af_head = af_count = 0;
+		af_bytes = 0;
+#endif
+		tbins_gen = gen;
+		pthread_once(&tbins_once, tb_key_create);
+		pthread_setspecific(tbins_key, tbins);
+	}
+	return tbins;
+}
+
+static void tb_key_create(void) {
+	pthread_key_create(&tbins_key, tb_exit);
+}
+
+/*
+ * free the blocks of an exiting thread's bins, all under one lock
+ */
+static void tb_exit(void *bins) {
+	struct tbin *bin = bins;
+	int i;
+
+	if (tbins_gen != __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE))
+		return;
+#ifdef AFREE
+	if (af_head)
+		af_flush();
+#endif
+	HEAP_LOCK();
+	for (i = 0; i < TB_CLASSES; i++) {
+		free_chain(bin[i].head);
+		bin[i].head = bin[i].count = 0;
+	}
+	HEAP_UNLOCK();
 }
 
 /*
- * Return whether the pointer is aligned.
- * May be useful for debugging.
+ * allocate a block of asize bytes from this thread's bin
+ */
+static void *tb_alloc(size_t asize) {
+	struct tbin *bin = &tb_get()[TB_IDX(asize)];
+	char *bp;
+
+	if (bin->head == 0 && tb_refill(bin, asize) == -1)
+		return NULL;
+	bp = itop(bin->head);
+	bin->head = GET(bp);
+	bin->count--;
+	return bp;
+}
+
+/*
+ * free a block of size bytes to this thread's bin
+ */
+static void tb_free(void *bp, size_t size) {
+	struct tbin *bin = &tb_get()[TB_IDX(size)];
+
+	PUT(bp, bin->head);
+	bin->head = ptoi(bp);
+	if (++bin->count >= 2 * TB_BATCH)
+		tb_drain(bin, TB_IDX(size));
+}
+
+/*
+ * fill an empty bin with a batch of blocks of (at least) asize bytes
+ * 1. a batch from the transfer cache, one CAS
+ * 2. otherwise up to TB_BATCH blocks from the free lists, one lock
+ * return 0 if success, -1 if no block could be allocated
+ */
+static int tb_refill(struct tbin *bin, size_t asize) {
+	unsigned int batch, n;
+	char *bp;
+
+	if ((batch = tc_pop(TB_IDX(asize))) != 0) {
+		bin->head = batch;
+		bin->count = TB_BATCH;
+		return 0;
+	}
+	HEAP_LOCK();
+	for (n = 0; n < TB_BATCH && (bp = alloc_block(asize)) != NULL; n++) {
+		PUT(bp, bin->head);
+		bin->head = ptoi(bp);
+	}
+	HEAP_UNLOCK();
+	bin->count = n;
+	return n? 0 : -1;
+}
+
+/*
+ * take the oldest TB_BATCH blocks off a bin of 2 * TB_BATCH as a batch
+ * 1. the newest TB_BATCH stay, still in cache
+ * 2. the batch goes to the transfer cache, or if it is full, to the
+ *    free lists under one lock
+ */
+static void tb_drain(struct tbin *bin, int cls) {
+	char *bp = itop(bin->head);
+	unsigned int batch;
+	int i;
+
+	for (i = 1; i < TB_BATCH; i++)
+		bp = itop(GET(bp));
+	batch = GET(bp);
+	PUT(bp, 0);
+	bin->count -= TB_BATCH;
+	if (!tc_push(cls, batch)) {
+		HEAP_LOCK();
+		free_chain(batch);
+		HEAP_UNLOCK();
+	}
+}
+
+/*
+ * pop a batch off the transfer cache of class cls, 0 if empty
+ * the link to the next batch is read before the CAS; if another thread
+ * popped and pushed it back meanwhile, the version has moved on
+ */
+static unsigned int tc_pop(int cls) {
+	unsigned long head, new_head;
+	char *bp;
+
+	head = __atomic_load_n(&tc_head[cls], __ATOMIC_ACQUIRE);
+	do {
+		if (HEAD_OFF(head) == 0)
+			return 0;
+		bp = itop(HEAD_OFF(head));
+		new_head = MAKE_HEAD(GET(bp + WSIZE), HEAD_VER(head) + 1);
+	} while (!__atomic_compare_exchange_n(&tc_head[cls], &head, new_head, 1,
+	                                      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+	__atomic_fetch_sub(&tc_count[cls], 1, __ATOMIC_RELAXED);
+	return HEAD_OFF(head);
+}
+
+/*
+ * push a batch on the transfer cache of class cls
+ * return 0 if the cache holds TC_BATCHES batches already
+ */
+static int tc_push(int cls, unsigned int batch) {
+	unsigned long head, new_head;
+	char *bp = itop(batch);
+
+	if (__atomic_load_n(&tc_count[cls], __ATOMIC_RELAXED) >= TC_BATCHES)
+		return 0;
+	__atomic_fetch_add(&tc_count[cls], 1, __ATOMIC_RELAXED);
+
+	head = __atomic_load_n(&tc_head[cls], __ATOMIC_RELAXED);
+	do {
+		PUT(bp + WSIZE, HEAD_OFF(head));
+		new_head = MAKE_HEAD(batch, HEAD_VER(head) + 1);
+	} while (!__atomic_compare_exchange_n(&tc_head[cls], &head, new_head, 1,
+	                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	return 1;
+}
+
+/*
+ * free a chain of blocks linked through their first word, heap lock held
+ */
+static void free_chain(unsigned int off) {
+	char *bp;
+
+	while (off) {
+		bp = itop(off);
+		off = GET(bp);
+		free_block(bp);
+	}
+}
+#endif /* def TBINS */
+
+#ifdef AFREE
+/*
+ * queued frees
+ */
+
+/*
+ * queue a block in this thread's buffer, pass the buffer on when full
  */
-static int aligned(const void *p) {
-    return (size_t)ALIGN(p) == (size_t)p;
+static void af_free(void *bp) {
+	tb_get();
+	PUT(bp, af_head);
+	af_head = ptoi(bp);
+	af_bytes += GET_SIZE(HDRP(bp));
+	if (++af_count >= AF_BATCH || af_bytes >= AF_MAX_BYTES)
+		af_flush();
 }
 
+/*
+ * pass this thread's buffer to the pending list, one CAS
+ * the list is only ever taken whole, so a plain head is safe
+ */
+static void af_flush(void) {
+	char *bp = itop(af_head);
+	unsigned int head;
+
+	head = __atomic_load_n(&af_pending, __ATOMIC_RELAXED);
+	do {
+		PUT(bp + WSIZE, head);
+	} while (!__atomic_compare_exchange_n(&af_pending, &head, af_head, 1,
+	                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	af_head = af_count = 0;
+	af_bytes = 0;
+	pthread_once(&af_once, af_start);
+}
+
+/*
+ * free all pending blocks, heap lock held
+ * 1. take the pending list whole
+ * 2. gather the blocks, up to AF_SORT_MAX at a time
+ * 3. free each gathering in address order
+ * The driver resets the heap (mem_reset_brk) before mm_init drops the
+ * list: a block past the heap end went with the old heap, and so did
+ * the rest of the list.
+ */
+static void af_drain(void) {
+	unsigned int chain, off, n = 0;
+
+	chain = __atomic_exchange_n(&af_pending, 0, __ATOMIC_ACQUIRE);
+	while (chain) {
+		off = chain;
+		if ((char *)itop(off) > (char *)mem_heap_hi())
+			return;
+		chain = GET(itop(chain) + WSIZE);
+		while (off) {
+			if ((char *)itop(off) > (char *)mem_heap_hi())
+				return;
+			if (n == AF_SORT_MAX) {
+				af_free_sorted(af_sorted, n);
+				n = 0;
+			}
+			af_sorted[n++] = off;
+			off = GET(itop(off));
+		}
+	}
+	af_free_sorted(af_sorted, n);
+}
+
+/*
+ * free n blocks by address: each run of adjacent blocks is made one
+ * free block, then coalesced with its neighbours and listed once
+ */
+static void af_free_sorted(unsigned int *off, unsigned int n) {
+	unsigned int i, j;
+	size_t size;
+	char *bp, *next_bp_hdrp;
+
+	qsort(off, n, sizeof(*off), af_cmp);
+	for (i = 0; i < n; i = j) {
+		bp = itop(off[i]);
+		size = GET_SIZE(HDRP(bp));
+		for (j = i + 1; j < n && itop(off[j]) == bp + size; j++) {
+			idx_clear(bp + size);
+			size += GET_SIZE(HDRP(bp + size));
+		}
+		PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)), 0));
+		PUT(FTRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)), 0));
+		next_bp_hdrp = HDRP(NEXT_BLKP(bp));
+		PUT(next_bp_hdrp, GET(next_bp_hdrp) & ~0x2);
+		coalesce(bp);
+	}
+}
+
+static int af_cmp(const void *a, const void *b) {
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * start the background thread, once, on the first buffer passed
+ */
+static void af_start(void) {
+	pthread_t tid;
+	pthread_attr_t attr;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&tid, &attr, af_thread, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * background thread: free the pending blocks every AF_INTERVAL_MS
+ */
+static void *af_thread(void *arg) {
+	struct timespec ts = {0, AF_INTERVAL_MS * 1000000L};
+
+	(void)arg;
+	for (;;) {
+		nanosleep(&ts, NULL);
+		if (__atomic_load_n(&af_pending, __ATOMIC_RELAXED) == 0)
+			continue;
+		HEAP_LOCK();
+		af_drain();
+		HEAP_UNLOCK();
+	}
+	return NULL;
+}
+#endif /* def AFREE */
+
+
+
 /*
  * mm_checkheap
  */
 void mm_checkheap(int lineno) {
+	HEAP_LOCK();
+	check_locked(lineno);
+	HEAP_UNLOCK();
+}
+
+/*
+ * the checks of mm_checkheap, heap lock held with TBINS
+ */
+static void check_locked(int lineno) {
 	void *bp, *hdrp, *ftrp;
-	unsigned int alloc;
 	void *bp_prev, *array_ptr;
 	unsigned int count_heap, count_lists;
 	unsigned int blk_size;
@@ -534,57 +1081,9 @@ void mm_checkheap(int lineno) {
 		printHeap(__LINE__);
 		exit(1);
 	}
-	/* prologue and epilogue */
-	bp = heap_listp;
-	hdrp = HDRP(bp);
-	ftrp = FTRP(bp);
-	/* check prologue */
-	if ((GET_SIZE(hdrp) != DSIZE) || (GET_ALLOC(hdrp) != 1)) {
-		printf("line %d: Prologue header wrong!\n", lineno);
-		printf("header size: %d\n", GET_SIZE(hdrp));
-		printf("alloc state: %d\n", GET_ALLOC(hdrp));
-		exit(1);
-	}
-	if ((GET_SIZE(hdrp) != GET_SIZE(ftrp)) || 
-		(GET_ALLOC(hdrp) != GET_ALLOC(ftrp))) {
-		printf("line %d: Prologue header/footer inconsistent!\n", lineno);
-		printf("header: (size %d, alloc: %d)\n", GET_SIZE(hdrp), 
-			    GET_ALLOC(hdrp));
-		printf("footer: (size %d, alloc: %d)\n", GET_SIZE(ftrp),
-				GET_ALLOC(ftrp));
-		exit(1);
-	}
-	/* check epilogue */
-	bp = mem_heap_hi()+1;
-	hdrp = HDRP(bp);
-	if ((GET_SIZE(hdrp) != 0) || GET_ALLOC(hdrp) != 1) {
-		printf("line %d: Epilogue wrong!\n", lineno);
-		printf("size: %d\n", GET_SIZE(hdrp));
-		printf("alloc: %d\n", GET_ALLOC(hdrp));
-	}
-	/* check each block's alignment */
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-		if (!aligned(bp)) {
-			printf("line %d: block not aligned!\n", lineno);
-			printf("block addr %p\n", bp);
-			exit(1);
-		}
-	}
-	/* check heap boundaries */
-	for (bp = heap_listp; bp < mem_heap_hi()+1; bp = NEXT_BLKP(bp)) {
-		if (!in_heap(bp)) {
-			printf("line %d: block %p not in heap range!\n", lineno, bp);
-			printf("heap_hi: %p, heap_lo: %p\n", mem_heap_hi(), mem_heap_lo());
-			exit(1);
-		}
-	}
-	if (bp > (mem_heap_hi()+1)) {
-		printf("line %d: block %p not in heap range!\n", lineno, bp);
-		printf("heap_hi: %p, heap_lo: %p\n", mem_heap_hi(), mem_heap_lo());
-		exit(1);	
-	}
-	/* check each free block's header and footer */
-	/* check minimum block size */
+	/* prologue, epilogue, blocks, free blocks' footers, coalescing */
+	core_checkheap(heap_listp, lineno);
+	/* check free blocks' footers keep prev_alloc too */
 	/* check current blk's prev_alloc match previous blk's alloc state */
 	bp_prev = heap_listp;
 	bp = NEXT_BLKP(heap_listp);
@@ -604,11 +1103,6 @@ void mm_checkheap(int lineno) {
 				exit(1);
 			}
 		}
-		if (GET_SIZE(hdrp) < MIN_BLK_SIZE) {
-			printf("line %d: less than minimum block size!\n", lineno);
-			printf("block %p, block size %d\n", bp, GET_SIZE(hdrp));
-			exit(1);
-		}
 		if (GET_PREV_ALLOC(hdrp) != GET_ALLOC(HDRP(bp_prev))) {
 			printf("line %d: curr's prev_alloc not match prev's alloc!\n", 
 				    lineno);
@@ -619,21 +1113,6 @@ void mm_checkheap(int lineno) {
 		}
 		bp_prev = bp;
 	}
-	/* check coalescing */
-	alloc = 1;
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-		if (alloc == 0 && GET_ALLOC(HDRP(bp)) == 0) {
-			printf("line %d: neighboring free blocks not coalesced!\n", 
-				    lineno);
-			printf("curr blk %p, alloc %u\n", bp, GET_ALLOC(HDRP(bp)));
-			printf("prev blk %p, alloc %u\n", PREV_BLKP(bp), 
-				    GET_ALLOC(HDRP(PREV_BLKP(bp))));
-			printHeap(lineno);
-			exit(1);
-		}
-		alloc = GET_ALLOC(HDRP(bp));
-	}
-
 	/* check free list */
 	/* all list pointers in heap */
 	array_ptr = free_lists_base;
@@ -711,7 +1190,7 @@ void mm_checkheap(int lineno) {
 		while (bp) {
 			blk_size = GET_SIZE(HDRP(bp));
 			if (blk_size < (unsigned int)(1 << power) || 
-				blk_size > (unsigned int)(1 << (power+1))) {
+				(power < MAX_PWR && blk_size > (unsigned int)(1 << (power+1)))) {
 				printf("line %d: block not within list size range!\n", lineno);
 				printf("class size: %u, block size %u\n", 
 					   (1<<power), blk_size);
@@ -789,3 +1268,10 @@ static void printLists(int lineno) {
 
 	return;
 }
+
+#ifdef MM_ENGINES
+const struct mm_engine mm_seg_engine = {
+	"seg", seg_init, seg_malloc, seg_free, seg_realloc, seg_calloc, seg_checkheap,
+	seg_block_of, seg_heap_stats
+};
+#endif /* def MM_ENGINES */
@@ -0,0 +1,737 @@
+/*
+ * mm-sim.c
+ *
+ * Offline allocator policy simulator: replays an allocation trace
+ * against metadata-only models of placement policies, without any
+ * payload memory, and reports peak heap, fragmentation over time and
+ * search cost. Several policies run side by side over one pass of the
+ * trace, so a trace is read and parsed once per sweep.
+ *
+ * Build: gcc -O2 -o mm-sim mm-sim.c
+ * Usage: mm-sim [-p policies] [-c chunk] [-a align] [-s slab_max]
+ *               [-i interval] [trace]
+ *   -p  comma separated: first, next, best, seg, tlsf, slab or all
+ *       (default first)
+ *   -c  heap extension unit in bytes (default 4096, as CHUNKSIZE)
+ *   -a  block alignment, 8 or 16 (default 8, 16 as ALIGN16)
+ *   -s  largest request served from slabs by the slab policy (256)
+ *   -i  print heap, live bytes and fragmentation every interval events
+ *
+ * The trace is the driver's format: an optional header of four
+ * numbers (heap size, ids, ops, weight), then one event per line,
+ * "a id size", "r id size" or "f id". The trace is streamed, only the
+ * per-id state is kept, and reads standard input without a file.
+ *
+ * Models: a block is a node with its offset and size, kept in address
+ * order for coalescing and on free lists by class. Block sizes follow
+ * mm.c: 8 bytes of header/footer, 16 bytes minimum. Policies:
+ *   first  one LIFO list, first fit
+ *   next   one LIFO list, first fit from a rover
+ *   best   one LIFO list, smallest fit
+ *   seg    power of 2 classes from 16 to 1M, first fit per class
+ *          then larger classes (mm-seglist.c)
+ *   tlsf   two-level segregated fit, 16 classes per power of 2,
+ *          requests rounded up so the head of a class always fits
+ *   slab   seg, with requests up to slab_max served from 4K slabs of
+ *          equal-size objects, slabs taken from and returned to seg
+ * Search cost counts the free blocks and classes looked at per
+ * allocation.
+ *
+ * first, next and best are the textbook list policies, not mm.c: the
+ * free top block stays on the list like any other, and there are no
+ * small block stacks in front. mm.c keeps its wilderness off the list
+ * as a last resort and reuses small blocks from per-size stacks, so
+ * its fragmentation and search cost differ from these models.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+
+#define FIRST 0
+#define NEXT  1
+#define BEST  2
+#define SEG   3
+#define TLSF  4
+#define SLAB  5
+#define NUM_POLICIES 6
+
+#define DSIZE        8      /* header + footer bytes */
+#define MIN_BLK_SIZE 16     /* minimum block size (bytes) */
+#define NUM_CLS      1024   /* free list classes, tlsf uses the most */
+#define SEG_MIN_PWR  4      /* seg: first class is [2^4, 2^5) */
+#define SEG_MAX_PWR  20     /* seg: last class is [2^20, inf) */
+#define TLSF_SL_BITS 4      /* tlsf: 2^4 classes per power of 2 */
+#define SLAB_BYTES   4096   /* slab size */
+#define SLAB_CLS     (4096 / 8) /* slab classes, one per 8 bytes */
+
+static const char *policy_names[NUM_POLICIES] =
+	{"first", "next", "best", "seg", "tlsf", "slab"};
+
+/* A heap block: address order links and free list links */
+typedef struct blk {
+	size_t off, size;
+	struct blk *aprev, *anext;
+	struct blk *fprev, *fnext;
+	int free;
+	int cls;
+} blk_t;
+
+/* A slab of equal size objects, carved from a heap block */
+typedef struct slab {
+	blk_t *blk;
+	int cls, used, cap;
+	struct slab *prev, *next; /* partial slabs of the class */
+} slab_t;
+
+/* What an id currently holds */
+typedef struct {
+	void *p;         /* blk_t or slab_t */
+	size_t size;     /* request size */
+	int kind;        /* 0 none, 1 block, 2 slab object */
+} slot_t;
+
+/* One simulated allocator */
+typedef struct sim {
+	const char *name;
+	int policy;                  /* heap policy, SEG for slab */
+	int slabs;                   /* slab front end over seg */
+	size_t brk;                  /* heap size */
+	blk_t *top;                  /* last block in address order */
+	blk_t *head[NUM_CLS];        /* free lists */
+	uint64_t map[NUM_CLS / 64];  /* non-empty free lists */
+	blk_t *rover;                /* next fit rover */
+	slab_t *partial[SLAB_CLS];   /* slabs with free objects */
+	slot_t *ids;
+	size_t nids;
+	/* statistics */
+	uint64_t allocs, probes, max_probe;
+	size_t live, peak_live, peak_brk;
+} sim_t;
+
+/* Options */
+static size_t chunksize = 4096;
+static size_t align = 8;
+static size_t slab_max = 256;
+static uint64_t interval = 0;
+
+/* Node pool: blocks and slabs are recycled, never freed */
+static blk_t *blk_pool = NULL;
+static slab_t *slab_pool = NULL;
+
+static blk_t *blk_new(void);
+static void blk_put(blk_t *b);
+static int cls_of(sim_t *s, size_t size);
+static void list_insert(sim_t *s, blk_t *b);
+static void list_delete(sim_t *s, blk_t *b);
+static blk_t *find_fit(sim_t *s, size_t asize);
+static blk_t *place(sim_t *s, blk_t *b, size_t asize);
+static blk_t *extend(sim_t *s, size_t asize);
+static blk_t *heap_alloc(sim_t *s, size_t asize);
+static void heap_free(sim_t *s, blk_t *b);
+static int heap_expand(sim_t *s, blk_t *b, size_t asize);
+static void sim_alloc(sim_t *s, size_t id, size_t size);
+static void sim_free(sim_t *s, size_t id);
+static void sim_realloc(sim_t *s, size_t id, size_t size);
+
+/*
+ * adjust_size - block size for a request, as in mm.c
+ */
+static size_t adjust_size(size_t size)
+{
+	if (size <= DSIZE)
+		return MIN_BLK_SIZE;
+	return (size + DSIZE + align-1) & ~(align-1);
+}
+
+static int log2_floor(size_t x)
+{
+	return 63 - __builtin_clzll(x);
+}
+
+/*
+ * cls_of - free list class of a free block of size bytes
+ */
+static int cls_of(sim_t *s, size_t size)
+{
+	int fl;
+
+	switch (s->policy) {
+	case SEG:
+		fl = log2_floor(size);
+		if (fl > SEG_MAX_PWR)
+			fl = SEG_MAX_PWR;
+		return fl - SEG_MIN_PWR;
+	case TLSF:
+		fl = log2_floor(size);
+		return (fl - SEG_MIN_PWR) << TLSF_SL_BITS |
+		       ((size >> (fl - TLSF_SL_BITS)) & ((1 << TLSF_SL_BITS) - 1));
+	default:
+		return 0;
+	}
+}
+
+static blk_t *blk_new(void)
+{
+	blk_t *b = blk_pool;
+
+	if (b)
+		blk_pool = b->fnext;
+	else if ((b = malloc(sizeof(*b))) == NULL) {
+		perror("mm-sim");
+		exit(1);
+	}
+	memset(b, 0, sizeof(*b));
+	return b;
+}
+
+static void blk_put(blk_t *b)
+{
+	b->fnext = blk_pool;
+	blk_pool = b;
+}
+
+/*
+ * list_insert - push a free block on its class list (LIFO)
+ */
+static void list_insert(sim_t *s, blk_t *b)
+{
+	int c = cls_of(s, b->size);
+
+	b->free = 1;
+	b->cls = c;
+	b->fprev = NULL;
+	b->fnext = s->head[c];
+	if (s->head[c])
+		s->head[c]->fprev = b;
+	s->head[c] = b;
+	s->map[c / 64] |= 1ULL << (c % 64);
+}
+
+/*
+ * list_delete - take a free block off its class list
+ */
+static void list_delete(sim_t *s, blk_t *b)
+{
+	int c = b->cls;
+
+	if (s->rover == b)
+		s->rover = b->fnext;
+	if (b->fprev)
+		b->fprev->fnext = b->fnext;
+	else
+		s->head[c] = b->fnext;
+	if (b->fnext)
+		b->fnext->fprev = b->fprev;
+	if (s->head[c] == NULL)
+		s->map[c / 64] &= ~(1ULL << (c % 64));
+	b->free = 0;
+}
+
+/*
+ * next_class - first non-empty class at or above c, -1 if none
+ */
+static int next_class(sim_t *s, int c)
+{
+	int w = c / 64;
+	uint64_t m;
+
+	if (c >= NUM_CLS)
+		return -1;
+	m = s->map[w] & (~0ULL << (c % 64));
+	while (!m) {
+		if (++w == NUM_CLS / 64)
+			return -1;
+		m = s->map[w];
+	}
+	return w * 64 + __builtin_ctzll(m);
+}
+
+/*
+ * find_fit - policy search for a free block of asize bytes,
+ * counting the blocks and classes looked at
+ */
+static blk_t *find_fit(sim_t *s, size_t asize)
+{
+	blk_t *b, *best = NULL;
+	uint64_t probes = 0;
+	int c, fl;
+
+	switch (s->policy) {
+	case NEXT:
+		for (b = s->rover; b; b = b->fnext, probes++)
+			if (b->size >= asize)
+				goto found;
+		for (b = s->head[0]; b && b != s->rover; b = b->fnext, probes++)
+			if (b->size >= asize)
+				goto found;
+		b = NULL;
+		break;
+	case BEST:
+		for (b = s->head[0]; b; b = b->fnext, probes++) {
+			if (b->size == asize) {
+				best = b;
+				break;
+			}
+			if (b->size > asize && (!best || b->size < best->size))
+				best = b;
+		}
+		b = best;
+		break;
+	case SEG:
+		/* first fit in the class, then any block of a larger class */
+		c = cls_of(s, asize);
+		for (b = s->head[c]; b; b = b->fnext, probes++)
+			if (b->size >= asize)
+				goto found;
+		probes++;
+		c = next_class(s, c + 1);
+		b = c < 0? NULL : s->head[c];
+		break;
+	case TLSF:
+		/* round up to the next class: its head always fits */
+		fl = log2_floor(asize);
+		c = cls_of(s, asize);
+		if (asize & ((1UL << (fl - TLSF_SL_BITS)) - 1))
+			c++;
+		probes++;
+		c = next_class(s, c);
+		b = c < 0? NULL : s->head[c];
+		break;
+	default:
+		for (b = s->head[0]; b; b = b->fnext, probes++)
+			if (b->size >= asize)
+				goto found;
+		break;
+	}
+found:
+	if (s->policy == NEXT && b)
+		s->rover = b;
+	s->probes += probes + 1;
+	if (probes + 1 > s->max_probe)
+		s->max_probe = probes + 1;
+	return b;
+}
+
+/*
+ * place - allocate asize bytes at the start of free block b,
+ * the remainder (if at least MIN_BLK_SIZE) stays free
+ */
+static blk_t *place(sim_t *s, blk_t *b, size_t asize)
+{
+	blk_t *r;
+	int was_rover = (s->rover == b);
+
+	list_delete(s, b);
+	if (b->size - asize >= MIN_BLK_SIZE) {
+		r = blk_new();
+		r->off = b->off + asize;
+		r->size = b->size - asize;
+		r->aprev = b;
+		r->anext = b->anext;
+		if (b->anext)
+			b->anext->aprev = r;
+		else
+			s->top = r;
+		b->anext = r;
+		b->size = asize;
+		list_insert(s, r);
+		if (was_rover)
+			s->rover = r;
+	}
+	return b;
+}
+
+/*
+ * extend - grow the heap so a block of asize bytes fits at its top,
+ * merging with a free top block, which stays on the free lists
+ */
+static blk_t *extend(sim_t *s, size_t asize)
+{
+	size_t have = 0, grow;
+	blk_t *b;
+
+	if (s->top && s->top->free) {
+		have = s->top->size;
+		list_delete(s, s->top);
+	}
+	grow = MAX(asize - have, chunksize);
+	grow = (grow + align-1) & ~(align-1);
+	s->brk += grow;
+	if (s->brk > s->peak_brk)
+		s->peak_brk = s->brk;
+	if (have) {
+		b = s->top;
+		b->size += grow;
+	}
+	else {
+		b = blk_new();
+		b->off = s->brk - grow;
+		b->size = grow;
+		b->aprev = s->top;
+		if (s->top)
+			s->top->anext = b;
+		s->top = b;
+	}
+	list_insert(s, b);
+	return b;
+}
+
+static blk_t *heap_alloc(sim_t *s, size_t asize)
+{
+	blk_t *b;
+
+	if ((b = find_fit(s, asize)) == NULL)
+		b = extend(s, asize);
+	return place(s, b, asize);
+}
+
+/*
+ * heap_free - free a block, coalescing with free neighbors
+ */
+static void heap_free(sim_t *s, blk_t *b)
+{
+	blk_t *n = b->anext, *p = b->aprev;
+
+	if (n && n->free) {
+		list_delete(s, n);
+		b->size += n->size;
+		b->anext = n->anext;
+		if (n->anext)
+			n->anext->aprev = b;
+		else
+			s->top = b;
+		blk_put(n);
+	}
+	if (p && p->free) {
+		list_delete(s, p);
+		p->size += b->size;
+		p->anext = b->anext;
+		if (b->anext)
+			b->anext->aprev = p;
+		else
+			s->top = p;
+		blk_put(b);
+		b = p;
+	}
+	list_insert(s, b);
+}
+
+/*
+ * heap_expand - grow an allocated block in place into a free next
+ * block or past the heap top, as mm_try_expand does.
+ * return 1 if the block now holds asize bytes
+ */
+static int heap_expand(sim_t *s, blk_t *b, size_t asize)
+{
+	blk_t *n = b->anext;
+
+	if (b->size >= asize)
+		return 1;
+	/* at the top, or only the free top block follows: grow the heap */
+	if (n == NULL || (n->free && n == s->top && b->size + n->size < asize)) {
+		extend(s, asize - b->size);
+		n = b->anext;
+	}
+	if (!n->free || b->size + n->size < asize)
+		return 0;
+	/* take what is needed off the front of the next block */
+	place(s, n, asize - b->size);
+	b->size += n->size;
+	b->anext = n->anext;
+	if (n->anext)
+		n->anext->aprev = b;
+	else
+		s->top = b;
+	blk_put(n);
+	return 1;
+}
+
+/*
+ * slab_alloc - an object of slab class c, a new slab if none has room
+ */
+static slab_t *slab_alloc(sim_t *s, int c)
+{
+	slab_t *sl = s->partial[c];
+
+	if (sl == NULL) {
+		if ((sl = slab_pool) != NULL)
+			slab_pool = sl->next;
+		else if ((sl = malloc(sizeof(*sl))) == NULL) {
+			perror("mm-sim");
+			exit(1);
+		}
+		s->allocs++;
+		sl->blk = heap_alloc(s, SLAB_BYTES + DSIZE);
+		sl->cls = c;
+		sl->used = 0;
+		sl->cap = SLAB_BYTES / ((c + 1) * 8);
+		sl->prev = sl->next = NULL;
+		s->partial[c] = sl;
+	}
+	if (++sl->used == sl->cap) {
+		s->partial[c] = sl->next;
+		if (sl->next)
+			sl->next->prev = NULL;
+	}
+	return sl;
+}
+
+/*
+ * slab_free - return an object, give the slab back to the heap once
+ * it is empty and the class has another slab with room
+ */
+static void slab_free(sim_t *s, slab_t *sl)
+{
+	int c = sl->cls;
+
+	if (sl->used-- == sl->cap) {
+		sl->prev = NULL;
+		sl->next = s->partial[c];
+		if (sl->next)
+			sl->next->prev = sl;
+		s->partial[c] = sl;
+	}
+	if (sl->used == 0 && (sl->prev || sl->next)) {
+		if (sl->prev)
+			sl->prev->next = sl->next;
+		else
+			s->partial[c] = sl->next;
+		if (sl->next)
+			sl->next->prev = sl->prev;
+		heap_free(s, sl->blk);
+		sl->next = slab_pool;
+		slab_pool = sl;
+	}
+}
+
+static slot_t *id_slot(sim_t *s, size_t id)
+{
+	size_t n;
+
+	if (id >= s->nids) {
+		n = MAX(id + 1, s->nids * 2);
+		if ((s->ids = realloc(s->ids, n * sizeof(*s->ids))) == NULL) {
+			perror("mm-sim");
+			exit(1);
+		}
+		memset(s->ids + s->nids, 0, (n - s->nids) * sizeof(*s->ids));
+		s->nids = n;
+	}
+	return &s->ids[id];
+}
+
+static void sim_alloc(sim_t *s, size_t id, size_t size)
+{
+	slot_t *d = id_slot(s, id);
+
+	if (d->kind)
+		sim_free(s, id);
+	if (s->slabs && size <= slab_max) {
+		d->p = slab_alloc(s, (MAX(size, 1) + 7) / 8 - 1);
+		d->kind = 2;
+	}
+	else {
+		s->allocs++;
+		d->p = heap_alloc(s, adjust_size(size));
+		d->kind = 1;
+	}
+	d->size = size;
+	s->live += size;
+	if (s->live > s->peak_live)
+		s->peak_live = s->live;
+}
+
+static void free_slot(sim_t *s, slot_t d)
+{
+	if (d.kind == 1)
+		heap_free(s, d.p);
+	else if (d.kind == 2)
+		slab_free(s, d.p);
+	else
+		return;
+	s->live -= d.size;
+}
+
+static void sim_free(sim_t *s, size_t id)
+{
+	slot_t *d = id_slot(s, id);
+
+	free_slot(s, *d);
+	d->kind = 0;
+}
+
+static void sim_realloc(sim_t *s, size_t id, size_t size)
+{
+	slot_t *d = id_slot(s, id), old;
+
+	if (d->kind == 1 && !(s->slabs && size <= slab_max) &&
+	    heap_expand(s, d->p, adjust_size(size))) {
+		s->live += size - d->size;
+		d->size = size;
+		if (s->live > s->peak_live)
+			s->peak_live = s->live;
+		return;
+	}
+	/* moved: the new block is allocated before the old one is freed */
+	old = *d;
+	d->kind = 0;
+	sim_alloc(s, id, size);
+	free_slot(s, old);
+}
+
+/*
+ * Trace reader: a buffered scanner, the trace may be far larger
+ * than memory
+ */
+static FILE *in;
+static char buf[1 << 20];
+static size_t buf_pos, buf_len;
+
+static int next_char(void)
+{
+	if (buf_pos == buf_len) {
+		buf_len = fread(buf, 1, sizeof(buf), in);
+		buf_pos = 0;
+		if (buf_len == 0)
+			return EOF;
+	}
+	return (unsigned char)buf[buf_pos++];
+}
+
+/* next non-blank character, comments ('#' to end of line) skipped */
+static int next_token(void)
+{
+	int c;
+
+	while ((c = next_char()) != EOF) {
+		if (c == '#')
+			while ((c = next_char()) != EOF && c != '\n')
+				;
+		else if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+			return c;
+	}
+	return EOF;
+}
+
+/* a decimal number starting with the character c (already read) */
+static size_t read_num(int c)
+{
+	size_t v = 0;
+
+	while (c >= '0' && c <= '9') {
+		v = v * 10 + (c - '0');
+		c = next_char();
+	}
+	return v;
+}
+
+static void report(sim_t *s, int n, uint64_t events)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		printf("%-6s %12llu events heap %12zu live %12zu frag %5.1f%%\n",
+		       s[i].name, (unsigned long long)events, s[i].brk, s[i].live,
+		       s[i].brk? 100.0 * (1.0 - (double)s[i].live / s[i].brk) : 0.0);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	sim_t *sims;
+	int opt, n = 0, i, c, p;
+	char *list = "first", *tok;
+	uint64_t events = 0, next_report;
+	size_t id, size;
+
+	while ((opt = getopt(argc, argv, "p:c:a:s:i:")) != -1) {
+		switch (opt) {
+		case 'p': list = optarg; break;
+		case 'c': chunksize = strtoull(optarg, NULL, 0); break;
+		case 'a': align = strtoull(optarg, NULL, 0); break;
+		case 's': slab_max = strtoull(optarg, NULL, 0); break;
+		case 'i': interval = strtoull(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "usage: %s [-p policies] [-c chunk] [-a align] "
+			        "[-s slab_max] [-i interval] [trace]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((align != 8 && align != 16) || chunksize == 0 ||
+	    slab_max > SLAB_CLS * 8) {
+		fprintf(stderr, "mm-sim: bad -a, -c or -s\n");
+		return 1;
+	}
+	if (!strcmp(list, "all"))
+		list = "first,next,best,seg,tlsf,slab";
+	if ((sims = calloc(NUM_POLICIES * 4, sizeof(*sims))) == NULL) {
+		perror("mm-sim");
+		return 1;
+	}
+	for (tok = strtok(list = strdup(list), ","); tok; tok = strtok(NULL, ",")) {
+		for (p = 0; p < NUM_POLICIES && strcmp(tok, policy_names[p]); p++)
+			;
+		if (p == NUM_POLICIES || n == NUM_POLICIES * 4) {
+			fprintf(stderr, "mm-sim: unknown policy '%s'\n", tok);
+			return 1;
+		}
+		sims[n].name = policy_names[p];
+		sims[n].policy = p == SLAB? SEG : p;
+		sims[n].slabs = (p == SLAB);
+		n++;
+	}
+
+	in = stdin;
+	if (optind < argc && (in = fopen(argv[optind], "r")) == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	/* skip the driver's header of four numbers */
+	c = next_token();
+	for (i = 0; i < 4 && c >= '0' && c <= '9'; i++) {
+		read_num(c);
+		c = next_token();
+	}
+
+	next_report = interval;
+	for (; c != EOF; c = next_token()) {
+		if (c != 'a' && c != 'r' && c != 'f') {
+			/* unknown line: skip it */
+			while ((c = next_char()) != EOF && c != '\n')
+				;
+			continue;
+		}
+		id = read_num(next_token());
+		size = (c != 'f')? read_num(next_token()) : 0;
+		for (i = 0; i < n; i++) {
+			if (c == 'a')
+				sim_alloc(&sims[i], id, size);
+			else if (c == 'r')
+				sim_realloc(&sims[i], id, size);
+			else
+				sim_free(&sims[i], id);
+		}
+		if (++events == next_report) {
+			report(sims, n, events);
+			next_report += interval;
+		}
+	}
+
+	printf("%-6s %12s %12s %6s %10s %10s\n", "policy", "peak heap",
+	       "peak live", "util", "probes", "max probe");
+	for (i = 0; i < n; i++) {
+		sim_t *s = &sims[i];
+		printf("%-6s %12zu %12zu %5.1f%% %10.2f %10llu\n",
+		       s->name, s->peak_brk,
+		       s->peak_live,
+		       s->peak_brk? 100.0 * s->peak_live / s->peak_brk : 0.0,
+		       s->allocs? (double)s->probes / s->allocs : 0.0,
+		       (unsigned long long)s->max_probe);
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * mm-stat.c
+ *
+ * Reader for the allocator's statistics file (MM_CONF stats=<path>):
+ * samples it from another process and prints one line per interval,
+ * with rates from the difference between samples.
+ *
+ * Build: gcc -O2 -o mm-stat mm-stat.c
+ * Usage: mm-stat [-i ms] [-n count] [-v] file
+ *   -i  sampling interval in milliseconds (default 1000)
+ *   -n  number of samples, 0 for no limit (default 0)
+ *   -v  also print the small stacks and tags in use
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "mm-stats.h"
+
+static void print_detail(const struct mm_shm_stats *st)
+{
+	int i;
+
+	for (i = 0; i < MM_STATS_SMALL; i++)
+		if (st->small[i])
+			printf("  small %4d: %10llu blocks\n", 16 + 8*i,
+			       (unsigned long long)st->small[i]);
+	for (i = 0; i < MM_STATS_TAGS; i++)
+		if (st->tag[i].count)
+			printf("  tag %2d: %12llu bytes %10llu blocks\n", i,
+			       (unsigned long long)st->tag[i].bytes,
+			       (unsigned long long)st->tag[i].count);
+}
+
+int main(int argc, char **argv)
+{
+	struct mm_shm_stats cur, prev;
+	struct mm_shm_stats *shm;
+	struct timespec ts;
+	long interval = 1000, count = 0, n;
+	int opt, fd, verbose = 0;
+	double dt, frag;
+
+	while ((opt = getopt(argc, argv, "i:n:v")) != -1) {
+		switch (opt) {
+		case 'i': interval = atol(optarg); break;
+		case 'n': count = atol(optarg); break;
+		case 'v': verbose = 1; break;
+		default: optind = argc; break;
+		}
+	}
+	if (optind != argc - 1 || interval <= 0) {
+		fprintf(stderr, "usage: %s [-i ms] [-n count] [-v] file\n", argv[0]);
+		return 1;
+	}
+	if ((fd = open(argv[optind], O_RDONLY)) == -1) {
+		perror(argv[optind]);
+		return 1;
+	}
+	shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (mm_stats_read(shm, &prev) == -1 || prev.magic != MM_STATS_MAGIC ||
+	    prev.version != MM_STATS_VERSION) {
+		fprintf(stderr, "%s: not an allocator statistics file\n", argv[optind]);
+		return 1;
+	}
+
+	printf("pid %lld\n", (long long)prev.pid);
+	printf("%10s %10s %10s %6s %10s %10s %10s %10s %10s\n", "heap KB",
+	       "free KB", "largest KB", "frag", "mapped KB", "cached KB",
+	       "live", "alloc/s", "free/s");
+	ts.tv_sec = interval / 1000;
+	ts.tv_nsec = (interval % 1000) * 1000000;
+	for (n = 0; count == 0 || n < count; n++) {
+		nanosleep(&ts, NULL);
+		if (mm_stats_read(shm, &cur) == -1)
+			continue;
+		/* rates over the publisher's clock, not ours */
+		dt = (cur.stamp_ms - prev.stamp_ms) / 1000.0;
+		frag = cur.free_bytes?
+		       100.0 * (1.0 - (double)cur.largest_free / cur.free_bytes) : 0.0;
+		printf("%10llu %10llu %10llu %5.1f%% %10llu %10llu %10llu",
+		       (unsigned long long)cur.heap_bytes >> 10,
+		       (unsigned long long)cur.free_bytes >> 10,
+		       (unsigned long long)cur.largest_free >> 10, frag,
+		       (unsigned long long)cur.mapped_bytes >> 10,
+		       (unsigned long long)cur.cached_bytes >> 10,
+		       (unsigned long long)cur.live);
+		if (dt > 0)
+			printf(" %10.0f %10.0f\n", (cur.allocs - prev.allocs) / dt,
+			       ((cur.allocs - cur.live) - (prev.allocs - prev.live)) / dt);
+		else
+			printf(" %10s %10s\n", "-", "-");
+		if (verbose)
+			print_detail(&cur);
+		fflush(stdout);
+		if (cur.stamp_ms != prev.stamp_ms)
+			prev = cur;
+	}
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * mm-stats.h
+ *
+ * Layout of the statistics file the allocator publishes when MM_CONF
+ * has stats=<path>: a background thread rewrites it every stats_ms
+ * milliseconds, read by mm-stat (or any monitor) from another process.
+ *
+ * The file is one struct mm_shm_stats, updated with a seqlock: seq is
+ * odd while an update is in progress. A reader copies the struct
+ * between two reads of seq and retries if they differ or are odd
+ * (mm_stats_read below). Nothing on the allocation path takes a lock
+ * or touches the file.
+ */
+#ifndef MM_STATS_H
+#define MM_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define MM_STATS_MAGIC   0x6d6d7374 /* "mmst" */
+#define MM_STATS_VERSION 1
+#define MM_STATS_SMALL   32         /* small stacks: 16, 24, ... bytes */
+#define MM_STATS_TAGS    16         /* MM_NUM_TAGS */
+
+struct mm_shm_stats {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t seq;              /* seqlock, odd while writing */
+	int64_t pid;
+	uint64_t stamp_ms;         /* CLOCK_MONOTONIC of the last update */
+	uint64_t heap_bytes;       /* sbrk heap size */
+	uint64_t free_bytes;       /* free blocks, wilderness included */
+	uint64_t free_blocks;
+	uint64_t largest_free;     /* largest free block */
+	uint64_t wild_bytes;       /* wilderness (top free block) */
+	uint64_t mapped_blocks;    /* large blocks with their own mapping */
+	uint64_t mapped_bytes;
+	uint64_t cached_bytes;     /* released mappings kept for reuse */
+	uint64_t allocs;           /* blocks allocated since start */
+	uint64_t live;             /* blocks allocated now, frees = allocs - live */
+	uint64_t small[MM_STATS_SMALL]; /* blocks on stack i, size 16 + 8i */
+	struct {
+		uint64_t bytes;
+		uint64_t count;
+	} tag[MM_STATS_TAGS];      /* live bytes and blocks per tag */
+};
+
+/*
+ * mm_stats_read - consistent copy of a published struct
+ * return 0 if success, -1 if the writer kept it busy
+ */
+static inline int mm_stats_read(const volatile struct mm_shm_stats *shm,
+                                struct mm_shm_stats *out)
+{
+	uint64_t seq;
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(out, (const void *)shm, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	}
+	return -1;
+}
+
+#endif /* MM_STATS_H */
@@ -0,0 +1,400 @@
+/*
+ * mm-stress.c
+ *
+ * Multithreaded stress tests for the concurrent paths of the
+ * allocators: the thread bins and transfer cache (TBINS) and queued
+ * frees (AFREE) of mm-seglist.c, and deferred free (mm_free_deferred)
+ * under either engine. Every block is filled with a pattern that is
+ * checked before it is freed, and the heap is checked after each test.
+ * Exits with status 1 on the first corruption found.
+ *
+ * Build: gcc -O2 -DDRIVER -DMM_ENGINES -DTBINS -DAFREE -o mm-stress \
+ *            mm-stress.c mm.c mm-seglist.c mm-engine.c memlib.c -pthread
+ * Usage: MM_ENGINE=seg|list mm-stress [-t threads] [-n ops] [test ...]
+ *   -t  threads per test, producer/consumer pairs for pc (default 4)
+ *   -n  operations per thread (default 200000)
+ * Tests (default all):
+ *   pc     producers allocate batches of blocks, consumers free them:
+ *          every free is from another thread (transfer cache, queued
+ *          frees passed between threads)
+ *   mt     threads allocate and free at random, small and large
+ *          blocks, then exit with their bins and buffers full
+ *   epoch  readers walk a shared stack inside epoch sections while
+ *          writers pop nodes, retire them with mm_free_deferred and
+ *          churn the heap so that a node freed early gets overwritten
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mm.h"
+
+#define PC_BATCH  512        /* blocks per producer batch */
+#define PC_QUEUE  8          /* batches in flight per pair */
+#define MT_SLOTS  512        /* blocks a mt thread holds at most */
+#define EP_READERS_MIN 2
+#define LIVE      0x600dbeefUL
+
+static int nthreads = 4;
+static long nops = 200000;
+
+static void fail(const char *test, const char *what)
+{
+	fprintf(stderr, "mm-stress %s (%s): %s\n", test, mm_engine_name(), what);
+	exit(1);
+}
+
+/* rng - xorshift64, one state per thread */
+static unsigned long rng(unsigned long *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/*
+ * fill/check - the pattern of a block: its size and a byte of its own
+ * in every byte, the size in the first word if it fits
+ */
+static void fill(unsigned char *p, size_t size, unsigned char tag)
+{
+	memset(p, tag, size);
+	if (size >= sizeof(size_t))
+		memcpy(p, &size, sizeof(size_t));
+}
+
+static int check(const unsigned char *p, size_t size, unsigned char tag)
+{
+	size_t i = 0, got;
+
+	if (size >= sizeof(size_t)) {
+		memcpy(&got, p, sizeof(size_t));
+		if (got != size)
+			return -1;
+		i = sizeof(size_t);
+	}
+	for (; i < size; i++)
+		if (p[i] != tag)
+			return -1;
+	return 0;
+}
+
+/*
+ * pc - producer/consumer pairs with a bounded queue each
+ */
+struct pc_batch {
+	unsigned char *p[PC_BATCH];
+	size_t size[PC_BATCH];
+};
+
+struct pc_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct pc_batch *slot[PC_QUEUE];
+	unsigned int head, tail;
+};
+
+static void pc_put(struct pc_queue *q, struct pc_batch *b)
+{
+	pthread_mutex_lock(&q->lock);
+	while (q->tail - q->head == PC_QUEUE)
+		pthread_cond_wait(&q->cond, &q->lock);
+	q->slot[q->tail++ % PC_QUEUE] = b;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static struct pc_batch *pc_get(struct pc_queue *q)
+{
+	struct pc_batch *b;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->tail == q->head)
+		pthread_cond_wait(&q->cond, &q->lock);
+	b = q->slot[q->head++ % PC_QUEUE];
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+	return b;
+}
+
+/* producer: mostly bin sized blocks, one in eight queued-free sized */
+static void *pc_producer(void *arg)
+{
+	struct pc_queue *q = arg;
+	struct pc_batch *b;
+	unsigned long s = (unsigned long)arg | 1;
+	long n;
+	int i;
+
+	for (n = 0; n < nops; n += PC_BATCH) {
+		if ((b = mm_malloc(sizeof(*b))) == NULL)
+			fail("pc", "out of memory");
+		for (i = 0; i < PC_BATCH; i++) {
+			rng(&s);
+			b->size[i] = s % 8? 1 + s % 240 : 257 + s % 8000;
+			if ((b->p[i] = mm_malloc(b->size[i])) == NULL)
+				fail("pc", "out of memory");
+			fill(b->p[i], b->size[i], (unsigned char)i);
+		}
+		pc_put(q, b);
+	}
+	pc_put(q, NULL);
+	return NULL;
+}
+
+static void *pc_consumer(void *arg)
+{
+	struct pc_queue *q = arg;
+	struct pc_batch *b;
+	int i;
+
+	while ((b = pc_get(q)) != NULL) {
+		for (i = 0; i < PC_BATCH; i++) {
+			if (check(b->p[i], b->size[i], (unsigned char)i) == -1)
+				fail("pc", "block changed between threads");
+			mm_free(b->p[i]);
+		}
+		mm_free(b);
+	}
+	return NULL;
+}
+
+static void test_pc(void)
+{
+	struct pc_queue *q = calloc(nthreads, sizeof(*q));
+	pthread_t *t = calloc(2 * nthreads, sizeof(*t));
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_mutex_init(&q[i].lock, NULL);
+		pthread_cond_init(&q[i].cond, NULL);
+		pthread_create(&t[2*i], NULL, pc_producer, &q[i]);
+		pthread_create(&t[2*i + 1], NULL, pc_consumer, &q[i]);
+	}
+	for (i = 0; i < 2 * nthreads; i++)
+		pthread_join(t[i], NULL);
+	free(q);
+	free(t);
+}
+
+/*
+ * mt - random allocate/free per thread, blocks left live at exit are
+ * freed, so the exiting thread's bins and buffer are full
+ */
+static void *mt_thread(void *arg)
+{
+	unsigned char *p[MT_SLOTS] = {0};
+	size_t size[MT_SLOTS];
+	unsigned long s = (unsigned long)arg * 2654435761UL + 1;
+	long n;
+	int i;
+
+	for (n = 0; n < nops; n++) {
+		i = rng(&s) % MT_SLOTS;
+		if (p[i]) {
+			if (check(p[i], size[i], (unsigned char)i) == -1)
+				fail("mt", "block changed");
+			mm_free(p[i]);
+			p[i] = NULL;
+			continue;
+		}
+		size[i] = (s >> 20) % 8? 1 + (s >> 24) % 240 : 1 + (s >> 24) % 20000;
+		if ((p[i] = mm_malloc(size[i])) == NULL)
+			fail("mt", "out of memory");
+		fill(p[i], size[i], (unsigned char)i);
+	}
+	for (i = 0; i < MT_SLOTS; i++)
+		if (p[i])
+			mm_free(p[i]);
+	return NULL;
+}
+
+static void test_mt(void)
+{
+	pthread_t *t = calloc(nthreads, sizeof(*t));
+	long i;
+
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&t[i], NULL, mt_thread, (void *)(i + 1));
+	for (i = 0; i < nthreads; i++)
+		pthread_join(t[i], NULL);
+	free(t);
+}
+
+/*
+ * epoch - a Treiber stack read inside sections, popped nodes retired;
+ * a reader that finds a node not LIVE has read freed memory
+ */
+struct ep_node {
+	unsigned long magic;
+	struct ep_node *next;
+	char pad[40];
+};
+
+static struct ep_node *ep_top;
+static volatile int ep_stop;
+static long ep_bad;
+
+static void *ep_reader(void *arg)
+{
+	struct ep_node *n;
+	long bad = 0;
+	int k;
+
+	(void)arg;
+	while (!ep_stop) {
+		mm_epoch_enter();
+		n = __atomic_load_n(&ep_top, __ATOMIC_ACQUIRE);
+		for (k = 0; n && k < 64; k++) {
+			if (n->magic != LIVE)
+				bad++;
+			n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE);
+		}
+		mm_epoch_exit();
+	}
+	__atomic_fetch_add(&ep_bad, bad, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void *ep_writer(void *arg)
+{
+	struct ep_node *n, *o;
+	void *x;
+	long i;
+
+	(void)arg;
+	for (i = 0; i < nops; i++) {
+		if ((n = mm_malloc(sizeof(*n))) == NULL)
+			fail("epoch", "out of memory");
+		n->magic = LIVE;
+		n->next = __atomic_load_n(&ep_top, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&ep_top, &n->next, n, 1,
+		                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		if (i % 2 == 0)
+			continue;
+		mm_epoch_enter();
+		o = __atomic_load_n(&ep_top, __ATOMIC_ACQUIRE);
+		while (o && !__atomic_compare_exchange_n(&ep_top, &o, o->next, 1,
+		                                         __ATOMIC_ACQUIRE,
+		                                         __ATOMIC_ACQUIRE))
+			;
+		mm_epoch_exit();
+		if (o) {
+			o->magic = 0xdead;
+			mm_free_deferred(o);
+		}
+		/* a node freed too early is reused and overwritten here */
+		if ((x = mm_malloc(sizeof(struct ep_node))) != NULL) {
+			memset(x, 0x5a, sizeof(struct ep_node));
+			mm_free(x);
+		}
+	}
+	return NULL;
+}
+
+static void test_epoch(void)
+{
+	int readers = nthreads < EP_READERS_MIN? EP_READERS_MIN : nthreads;
+	pthread_t *t = calloc(readers + nthreads, sizeof(*t));
+	struct mm_epoch_stats es;
+	struct ep_node *n;
+	int i;
+
+	ep_stop = 0;
+	for (i = 0; i < readers; i++)
+		pthread_create(&t[i], NULL, ep_reader, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&t[readers + i], NULL, ep_writer, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(t[readers + i], NULL);
+	ep_stop = 1;
+	for (i = 0; i < readers; i++)
+		pthread_join(t[i], NULL);
+	free(t);
+	if (ep_bad)
+		fail("epoch", "a reader saw a freed node");
+
+	while ((n = ep_top) != NULL) {
+		ep_top = n->next;
+		mm_free_deferred(n);
+	}
+	mm_epoch_barrier();
+	mm_epoch_reclaim();
+	mm_epoch_stats(&es);
+	if (es.retired_blocks != 0)
+		fail("epoch", "retired blocks left after a barrier");
+}
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+} tests[] = {
+	{ "pc", test_pc },
+	{ "mt", test_mt },
+	{ "epoch", test_epoch },
+};
+#define NUM_TESTS (sizeof(tests) / sizeof(tests[0]))
+
+static void run(int i)
+{
+	struct timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	tests[i].run();
+	mm_checkheap(__LINE__);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("%-6s %-5s %2d threads %8ld ops  %7.1f ms  ok\n", tests[i].name,
+	       mm_engine_name(), nthreads, nops, (t1.tv_sec - t0.tv_sec) * 1e3 +
+	       (t1.tv_nsec - t0.tv_nsec) / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	int c, found;
+
+	while ((c = getopt(argc, argv, "t:n:")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'n':
+			nops = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-n ops] [test ...]\n",
+			        argv[0]);
+			return 2;
+		}
+	}
+	if (nthreads < 1 || nops < 1) {
+		fprintf(stderr, "%s: threads and ops must be positive\n", argv[0]);
+		return 2;
+	}
+	if (mm_init() == -1) {
+		fprintf(stderr, "%s: mm_init failed\n", argv[0]);
+		return 1;
+	}
+	if (optind == argc) {
+		for (i = 0; i < NUM_TESTS; i++)
+			run(i);
+		return 0;
+	}
+	for (; optind < argc; optind++) {
+		for (i = 0, found = 0; i < NUM_TESTS; i++)
+			if (strcmp(argv[optind], tests[i].name) == 0) {
+				run(i);
+				found = 1;
+			}
+		if (!found) {
+			fprintf(stderr, "%s: unknown test %s\n", argv[0], argv[optind]);
+			return 2;
+		}
+	}
+	return 0;
+}
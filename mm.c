@@ -12,27 +12,89 @@
  * system is less than 2^32 bytes. Hence, the minimum block size
  * is 16 bytes. Worst-case allocation time is linear to the
  * number of free blocks. Free takes constant time.
+ * The topmost free block (the wilderness) is kept off the list and
+ * only used when no listed block fits: allocations from it bump its
+ * start, so the heap top stays contiguous.
+ * Small blocks (up to SMALL_MAX bytes) are freed to lock-free
+ * per-size stacks in front of the heap and reused from there by any
+ * thread; everything else runs under one heap lock.
+ * Large requests (mmap_threshold and up) get a mapping of their own,
+ * released mappings are cached for a while and reused.
+ * Blocks retired with mm_free_deferred are freed once an epoch grace
+ * period has passed.
  * 
  * 
  */
+#define _GNU_SOURCE /* mremap */
+
+/*
+ * Define ALIGN16 for 16-byte aligned payloads (max_align_t on x86-64):
+ * block sizes become multiples of 16, headers stay 4 bytes in the word
+ * before the payload and the minimum block stays 16 bytes.
+ * (Here, ahead of mm-core.h, which sets ALIGNMENT from it.)
+ */
+#define ALIGN16x
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
 
 #include "mm.h"
+#include "mm-engine.h"
+#include "mm-stats.h"
 #include "memlib.h"
+#include "mm-core.h"
+#include "mm-pageheap.h"
+#include "mm-mesh.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
 // #define DEBUG
 #ifdef DEBUG
-# define dbg_printf(...) printf(__VA_ARGS__)
+# define dbg_printf(...) CHECK_PRINTF(__VA_ARGS__)
 #else
 # define dbg_printf(...)
 #endif
 
+/* 
+ * Tracepoints: USDT probes (provider "mm") when <sys/sdt.h> is
+ * available, a no-op otherwise. A probe site is a single nop.
+ */
+#if defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define MM_PROBE(name, a, b)    DTRACE_PROBE2(mm, name, a, b)
+#  define MM_PROBE3(name, a, b, c) DTRACE_PROBE3(mm, name, a, b, c)
+# endif
+#endif
+#ifndef MM_PROBE
+# define MM_PROBE(name, a, b)
+# define MM_PROBE3(name, a, b, c)
+#endif
+
+/* 
+ * Call the registered hook for event: one predictable branch on
+ * hooks_on when no hooks are registered. Event and probe names avoid
+ * malloc/free/realloc, which DRIVER builds redefine.
+ */
+#define MM_HOOK(event, ...) \
+	do { \
+		if (__builtin_expect(hooks_on, 0) && hook_table.event) \
+			hook_table.event(__VA_ARGS__, hook_table.arg); \
+	} while (0)
+
 /* do not change the following! */
 #ifdef DRIVER
 /* create aliases for driver tests */
@@ -40,67 +102,330 @@
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define mallinfo2(...) mm_mallinfo2(__VA_ARGS__) /* not the struct tag */
+#define mallopt mm_mallopt
+#define malloc_trim mm_malloc_trim
+#define malloc_stats mm_malloc_stats
 #endif /* def DRIVER */
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
-
-/* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
-
 /*
- * If NEXT_FIT defined use next fit search, else use first fit search 
+ * With MM_ENGINES this is the "list" engine behind mm-engine.c, which
+ * owns the entry points: ours get a list_ prefix.
  */
-#define NEXT_FITx
+#ifdef MM_ENGINES
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+#define mm_init list_init
+#define malloc list_malloc
+#define free list_free
+#define realloc list_realloc
+#define calloc list_calloc
+#define mm_checkheap list_checkheap
+#define mm_block_of list_block_of
+#define mm_heap_stats(...) list_heap_stats(__VA_ARGS__) /* not the struct tag */
+#endif /* def MM_ENGINES */
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
+/*
+ * Fit policies for the free list search, chosen at run time (policy=)
+ */
+#define FIT_FIRST 0 /* first fit from the root */
+#define FIT_NEXT  1 /* first fit from where the last search stopped */
+#define FIT_BEST  2 /* smallest fitting block */
 
-/* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
+/* Constants and macros beyond those of mm-core.h */
+#define MAX_SBRK_INCR 0x7fffffff /* mem_sbrk takes an int increment */
+#define TRIM_THRESHOLD (128*1024) /* default M_TRIM_THRESHOLD (bytes) */
+#define MMAP_THRESHOLD (1<<20)    /* default M_MMAP_THRESHOLD (bytes) */
 
-/* Basic constants and macros */
-#define WSIZE       4       /* Word and header/footer size (bytes) */
-#define DSIZE       8       /* Doubleword size (bytes) */
-#define CHUNKSIZE  (1<<12)  /* Extend heap by this amount (bytes) */
-#define MIN_BLK_SIZE 16 /* minimum block size (bytes) */  
+/*
+ * Huge pages (hugepage=1): the heap grows to HUGE_PAGE boundaries and
+ * asks for transparent huge pages, fits that stay in huge pages the
+ * heap already uses are taken before fits that would start on an
+ * empty one, and the wilderness is trimmed in whole huge pages only,
+ * so a huge page is either in use or returned. malloc_trim, asked for
+ * under memory pressure, still releases every free small page.
+ */
+#define HUGE_PAGE (2UL<<20)
+#define HUGE_DOWN(p) ((char *)((size_t)(p) & ~(HUGE_PAGE-1)))
+#define HUGE_UP(p)   HUGE_DOWN((char *)(p) + HUGE_PAGE-1)
 
-#define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc)) //line:vm:mm:pack
 
-/* Read and write a word at address p */
-#define GET(p)       (*(unsigned int *)(p))            
-#define PUT(p, val)  (*(unsigned int *)(p) = (val))    
+/* 
+ * Allocation tag of an allocated block: 4 bits split over the unused
+ * bits 1-2 of the header (low half) and of the footer (high half)
+ */
+#define TAG_BITS 0x6
+#define GET_TAG(bp)  (((GET(HDRP(bp)) & TAG_BITS) >> 1) | \
+                      ((GET(FTRP(bp)) & TAG_BITS) << 1))
+#define PUT_TAG(bp, tag) \
+	(PUT(HDRP(bp), (GET(HDRP(bp)) & ~TAG_BITS) | (((tag) & 0x3) << 1)), \
+	 PUT(FTRP(bp), (GET(FTRP(bp)) & ~TAG_BITS) | (((tag) & 0xc) >> 1)))
+
+/* Per-tag counters are sharded to keep threads off each other's lines */
+#define TAG_SHARDS 16
+
+/* 
+ * Small block stacks: one per block size 16, 24, ..., SMALL_MAX.
+ * A stack head is a tagged offset: free list style 32-bit offset of
+ * the top block in the low half, version counter in the high half,
+ * so pop/push is one 64-bit CAS and a recycled top never matches (ABA).
+ */
+#define SMALL_MAX   256 /* largest block size kept on a stack */
+#define NUM_SMALL   ((SMALL_MAX - MIN_BLK_SIZE) / DSIZE + 1)
+#define SMALL_CACHE 64 /* max blocks per stack, the rest is coalesced */
+#define SMALL_IDX(asize) (((asize) - MIN_BLK_SIZE) / DSIZE)
+
+/*
+ * calloc zeroes blocks of at least PAR_ZERO_MIN bytes with a pool of
+ * up to PAR_ZERO_THREADS helper threads, in PAR_ZERO_PART byte parts
+ */
+#define PAR_ZERO_MIN     (16<<20)
+#define PAR_ZERO_PART    (2<<20)
+#define PAR_ZERO_THREADS 8
+
+/*
+ * Define SBRK_ZEROED if mem_sbrk hands out zero-filled memory (fresh
+ * pages of a mapping, as memlib.c does): calloc then skips zeroing
+ * blocks carved from heap memory that was never handed out before.
+ */
+#define SBRK_ZEROED
+
+/*
+ * Mapped blocks: a large block is its own mapping, the mapping length
+ * in the first 8 bytes, then a size 0 allocated footer and header
+ * (tag bits included) so bp keeps the heap block layout. No heap block
+ * has size 0, a size 0 header marks a mapped block. Released mappings
+ * stay in a cache of MAP_CACHE_SLOTS for up to decay_ms.
+ */
+#define MAP_OVERHEAD    (2*DSIZE)
+#define MAP_LEN(bp)     (*(size_t *)((char *)(bp) - MAP_OVERHEAD))
+#define IS_MAPPED(bp)   (GET_SIZE(HDRP(bp)) == 0)
+#define MAP_CACHE_SLOTS 16
+#define MAP_CACHE_BYTES (64<<20)
+#define MAP_DECAY_MS    1000
+
+/*
+ * Define PAGEHEAP to take the memory of mapped blocks from the page
+ * heap (mm-pageheap.c, linked in) instead of a mapping each: released
+ * blocks coalesce there into free spans for later ones, and the page
+ * heap returns spans to the OS past its dirty limit. Resizes are in
+ * place or by copy, never mremap. Off by default, and only mapped
+ * blocks use it: no size class is served from page heap spans.
+ */
+#define PAGEHEAPx
+
+/*
+ * Define MESH to take blocks up to MESH_MAX bytes from the mesh arena
+ * (mm-mesh.c, linked in): one block size per page, and sparse pages of
+ * a size are meshed onto shared physical pages. A slot holds a block
+ * laid out as in the heap, header and footer included.
+ * Meshing write protects pages for a moment: a system call that writes
+ * into such a block then fails with EFAULT, and the arena's SIGSEGV
+ * handler must stay installed (see mm-mesh.h). Not for applications
+ * that read(2) into small blocks or own SIGSEGV.
+ */
+#define MESHx
+
+/*
+ * Deferred free: a thread seals its retired blocks into a batch every
+ * EPOCH_BATCH blocks and keeps up to EPOCH_SLOTS sealed batches, a
+ * batch sealed at epoch e is freed once the global epoch reaches e + 2.
+ * If the slots are full (a reader is stalled), the new batch joins the
+ * newest one and takes its stamp.
+ */
+#define EPOCH_BATCH 64
+#define EPOCH_SLOTS 4
 
-/* Read the size and allocated fields from address p */
-#define GET_SIZE(p)  (GET(p) & ~0x7)                   
-#define GET_ALLOC(p) (GET(p) & 0x1)                    
+/* mm_check_snapshot kills a child that has not reported by then */
+#define SNAP_TIMEOUT_MS 30000
 
-/* Given block ptr bp, compute address of its header and footer */
-#define HDRP(bp)       ((char *)(bp) - WSIZE)                     
-#define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) 
+/* default interval of the statistics file updates (stats=) */
+#define STATS_MS 1000
+
+/*
+ * mm_malloc_near looks at up to NEAR_STEPS blocks on each side of the
+ * hint, no further than NEAR_SPAN bytes (a page) away
+ */
+#define NEAR_SPAN  4096
+#define NEAR_STEPS 16
 
-/* Given block ptr bp, compute address of next and previous blocks */
-#define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
-#define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE))) 
+#define HEAD_OFF(head) ((unsigned int)(head))
+#define HEAD_VER(head) ((unsigned int)((head) >> 32))
+#define MAKE_HEAD(off, ver) (((unsigned long)(ver) << 32) | (off))
 
 /* Global variables */
 static char *heap_listp = 0;  /* Pointer to first block */  
-#ifdef NEXT_FIT
-static char *rover;           /* Next fit rover */
-#endif
+static char *rover = 0;       /* Next fit rover, a listed free block */
 static char *root = 0; /* Pointer to first free block */
 static char *heap_base = 0; /* Starting address of the heap */
+char *mm_ref_base = 0;      /* heap_base, exported for mm_deref32 */
+static char *wild = 0; /* Topmost free block (not in the list), or NULL */
+static char *heap_clean = 0; /* Heap memory from here up never handed out */
+static char *heap_released = 0; /* Wilderness pages from here up released */
+
+/* 
+ * Run-time configuration: defaults are the constants above, the
+ * MM_CONF environment variable overrides them once at init, e.g.
+ * MM_CONF="chunk=1M,trim_threshold=256K,policy=best"
+ */
+static struct {
+	size_t chunksize;          /* chunk: heap extension unit */
+	size_t trim_threshold;     /* trim_threshold: also M_TRIM_THRESHOLD */
+	size_t top_pad;            /* top_pad: also M_TOP_PAD */
+	size_t small_max;          /* small_max: largest stacked block */
+	unsigned int small_cache;  /* small_cache: blocks per stack */
+	size_t zero_min;           /* zero_min: parallel calloc threshold */
+	int policy;                /* policy: first, next or best */
+	size_t mmap_threshold;     /* mmap_threshold: also M_MMAP_THRESHOLD */
+	size_t map_cache;          /* map_cache: max bytes of cached mappings */
+	long decay_ms;             /* decay_ms: cache lifetime, 0 no cache */
+	int map_lazy;              /* map_lazy: cache mappings MADV_FREE */
+	int hugepage;              /* hugepage: huge page aware growth */
+	char stats_path[128];      /* stats: statistics file, "" for none */
+	long stats_ms;             /* stats_ms: statistics file interval */
+} conf = {
+	CHUNKSIZE, TRIM_THRESHOLD, 0, SMALL_MAX, SMALL_CACHE, PAR_ZERO_MIN,
+	FIT_FIRST, MMAP_THRESHOLD, MAP_CACHE_BYTES, MAP_DECAY_MS, 0, 0, "",
+	STATS_MS
+};
+static int conf_loaded = 0;
+static const char *policy_names[] = {"first", "next", "best"};
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Event hooks, see mm_set_hooks */
+static struct mm_hooks hook_table;
+static int hooks_on = 0;
+
+/* Small block stacks, their blocks stay allocated in the heap */
+static unsigned long small_head[NUM_SMALL];
+static unsigned int small_count[NUM_SMALL]; /* approximate depth */
+
+/* Mapped blocks in use and the cache of released mappings */
+static struct {
+	pthread_mutex_t lock;
+	struct {
+		char *start;
+		size_t len;
+		long stamp;                /* release time (ms) */
+	} slot[MAP_CACHE_SLOTS];       /* oldest first */
+	int n;
+	size_t bytes;                  /* cached bytes */
+	size_t live, live_bytes;       /* mapped blocks in use */
+	char **index;                  /* mapped blocks in use, by address */
+	size_t index_n, index_cap;
+} map_cache = { PTHREAD_MUTEX_INITIALIZER };
+
+/* Per-tag accounting */
+static __thread int cur_tag = 0;      /* tag for untagged requests */
+static __thread int tag_shard = -1;   /* this thread's counter shard */
+static unsigned int next_shard = 0;   /* round-robin shard assignment */
+static struct {
+	struct mm_tag_stats tag[MM_NUM_TAGS];
+	size_t allocs;                    /* blocks allocated, cumulative */
+} tag_stats[TAG_SHARDS] __attribute__((aligned(64)));
+
+/*
+ * Epoch records, one per thread that uses the epoch calls, on a list
+ * that only grows: a record is kept when its thread exits, with its
+ * batches still waiting, and claimed again by a later thread.
+ * Retired blocks are linked through their first payload word.
+ */
+struct epoch_batch {
+	char *head, *tail;
+	size_t count, bytes;
+	unsigned long stamp;              /* global epoch when sealed */
+};
+struct epoch_rec {
+	unsigned long state;              /* epoch on entry << 1 | inside */
+	int nest;                         /* mm_epoch_enter depth */
+	int in_use;                       /* claimed by a thread */
+	struct epoch_rec *next;
+	struct epoch_batch open;          /* retired, not sealed yet */
+	struct epoch_batch sealed[EPOCH_SLOTS]; /* oldest first */
+	int nsealed;
+} __attribute__((aligned(64)));
+static unsigned long global_epoch = 1;
+static struct epoch_rec *epoch_recs;  /* all records */
+static __thread struct epoch_rec *my_rec;
+static pthread_key_t epoch_key;       /* drops the record at thread exit */
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static size_t retired_bytes, retired_blocks, retired_freed;
+/* sections of threads without a record: while any is open, the epoch stays */
+static unsigned int epoch_blockers;
+static __thread int blocker_nest;
+/* their retired blocks, under epoch_shared_lock */
+static struct epoch_rec epoch_shared;
+static pthread_mutex_t epoch_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Statistics file (stats=), published by a background thread */
+static int stats_pending = 0;         /* file configured, not started */
+static struct mm_shm_stats *stats_shm;
 
 /* Function prototypes for internal helper routines */
 static void *extend_heap(size_t words);
+static size_t adjust_size(size_t size);
+static int malloc_init(void);
+static int heap_ours(void);
+static void *alloc_block(size_t size, int *fresh);
+static void *heap_block(size_t size, int *fresh);
+#ifdef MESH
+static void *mesh_block(size_t size, int *fresh);
+#endif
+static void *tagged_alloc(size_t size, int tag, int *fresh);
+static void free_block(void *bp);
+static void *heap_alloc(size_t asize, int *fresh);
+static void zero_block(void *bp, size_t bytes);
+static void *small_pop(size_t asize);
+static size_t expand_block(void *ptr, size_t asize);
+static int small_push(void *bp, size_t size);
+static void tag_account(int tag, long bytes, long count);
 static void place(void *bp, size_t asize);
 static void *find_fit(size_t asize);
+static void *huge_fit(size_t asize);
+static int huge_spill(void *bp, size_t asize);
 static void *coalesce(void *bp);
+static void *wild_alloc(size_t asize, int *fresh);
+static void *near_fit(char *hint, size_t asize);
+static void snap_child(int fd);
+static void snap_send(int fd, struct mm_snapshot *snap);
+static void release_free(void *bp);
+static size_t release_pages(char *lo, char *hi, size_t unit);
+static void trim_wild(size_t pad);
 static void deleteFree(void *bp);
 static void insertFree(void *bp);
+static size_t block_size(void *bp);
+static size_t usable_size(void *bp);
+/* mapped block helper functions */
+static void *map_alloc(size_t size, int *fresh);
+static void *map_resize(void *bp, size_t size, int flags);
+static void map_release(void *bp);
+static void map_decay(long now);
+static void map_unmap(char *start, size_t len);
+static char *map_pages(size_t len, int *zero);
+static void map_shrink(char *start, size_t len, size_t need);
+static char *map_remap(char *start, size_t len, size_t need, int flags);
+static long now_ms(void);
+static size_t map_index_pos(const void *p);
+static void map_index_add(char *bp);
+static void map_index_del(char *bp);
+/* deferred free helper functions */
+static struct epoch_rec *epoch_rec_get(void);
+static void epoch_key_create(void);
+static void epoch_rec_drop(void *rec);
+static void epoch_retire(struct epoch_rec *rec, void *ptr);
+static void epoch_seal(struct epoch_rec *rec);
+static int epoch_advance(void);
+static size_t epoch_reclaim(struct epoch_rec *rec);
+/* statistics file helper functions */
+static void stats_start(void);
+static void *stats_worker(void *arg);
+static void stats_publish(void);
 /* User helper function */
 static unsigned int ptoi(char * p);
 static char *itop(unsigned int p);
@@ -112,191 +437,2291 @@ static char *get_next_free(void *bp);
 static char *get_prev_free(void *bp);
 /* heap checking helper function */
 static void printImg(void);
+/* configuration helper function */
+static void conf_load(void);
+
+/* 
+ * mm_init - Initialize the memory manager,
+ * return 0 if success, -1 if error.
+ * 1. start with 4-word structure (padding+proglogue+epilogue)
+ * 2. insert a free block with chunksize bytes
+ * 3. point the chunk to previous and next free blocks
+ * 4. initialize root and heap_base address
+ */
+int mm_init(void) 
+{
+    if (!conf_loaded)
+		conf_load();
+
+    /* Create the initial empty heap */
+    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1) 
+		return -1;
+#ifdef ALIGN16
+	/* the first payload follows the 4 words: start them 16-aligned */
+	if ((size_t)heap_listp % ALIGNMENT) {
+		if (mem_sbrk(2*WSIZE) == (void *)-1)
+			return -1;
+		heap_listp += 2*WSIZE;
+	}
+#endif
+	/* Get the heap base address */
+	heap_base = heap_listp;
+	mm_ref_base = heap_base;
+	if (idx_init(heap_base, 0x100000000UL) == -1)
+		return -1;
+	/* Initialize root, wilderness and the small block stacks */
+	root = 0;
+	rover = 0;
+	wild = 0;
+	heap_clean = 0;
+	heap_released = 0;
+	memset(small_head, 0, sizeof(small_head));
+	memset(small_count, 0, sizeof(small_count));
+    PUT(heap_listp, 0);                          /* Alignment padding */
+    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
+    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
+    PUT(heap_listp + (3*WSIZE), PACK(0, 1));     /* Epilogue header */
+    heap_listp += (2*WSIZE);                     //line:vm:mm:endinit  
+
+ 
+    /* Extend the empty heap with a free block of chunksize bytes */
+    if (extend_heap(conf.chunksize/WSIZE) == NULL) 
+		return -1;
+
+	// mm_checkheap(__LINE__);
+    return 0;
+}
+
+/* 
+ * mm_malloc - Allocate a block with at least size bytes of payload
+ * the block is charged to the calling thread's current tag
+ */
+void *malloc(size_t size) 
+{
+    char *bp;      
+
+    bp = tagged_alloc(size, cur_tag, NULL);
+    if (bp) {
+		MM_PROBE(alloc, bp, size);
+		MM_HOOK(on_alloc, bp, size);
+    }
+    return bp;
+}
+
+/*
+ * tagged_alloc - allocate a block and charge it to tag
+ */
+static void *tagged_alloc(size_t size, int tag, int *fresh)
+{
+    char *bp;      
+
+    if ((bp = alloc_block(size, fresh)) != NULL) {
+		PUT_TAG(bp, tag);
+		tag_account(tag, block_size(bp), 1);
+    }
+    return bp;
+}
+
+/*
+ * malloc_init - first use of the heap, mm_init under the heap lock
+ */
+static int malloc_init(void)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&heap_lock);
+    if (heap_listp == 0)
+		ret = mm_init();
+    pthread_mutex_unlock(&heap_lock);
+    return ret;
+}
+
+/*
+ * heap_ours - whether this engine runs the heap. With MM_ENGINES the
+ * heap may be another engine's (even after ours ran it, heap_listp
+ * left set): the list-only entry points refuse it and its blocks.
+ */
+static int heap_ours(void)
+{
+#ifdef MM_ENGINES
+    return mm_engine() == &mm_list_engine;
+#else
+    return 1;
+#endif
+}
+
+/*
+ * alloc_block - find or make a block with at least size bytes of payload
+ * small sizes are popped from their stack without taking the lock,
+ * large ones get a mapping of their own.
+ * *fresh (if fresh is not NULL) is set if the payload is known zero.
+ */
+static void *alloc_block(size_t size, int *fresh)
+{
+    if (!heap_ours() || (heap_listp == 0 && malloc_init() == -1))
+		return NULL;
+    if (__builtin_expect(stats_pending, 0))
+		stats_start();
+    /* Ignore spurious requests */
+    if (size == 0)
+		return NULL;
+#ifdef MESH
+    if (size <= MESH_MAX - DSIZE) {
+		char *bp = mesh_block(size, fresh);
+
+		if (bp)
+			return bp;
+    }
+#endif
+    if (size >= conf.mmap_threshold || 
+		size > MAX_SBRK_INCR - conf.chunksize)
+		return map_alloc(size, fresh);
+    return heap_block(size, fresh);
+}
+
+#ifdef MESH
+/*
+ * mesh_block - alloc_block from the mesh arena, NULL if it is full
+ */
+static void *mesh_block(size_t size, int *fresh)
+{
+    size_t asize = adjust_size(size);
+    char *slot, *bp;
+
+    if (asize > MESH_MAX || (slot = mesh_alloc(asize)) == NULL)
+		return NULL;
+    bp = slot + WSIZE;
+    PUT(HDRP(bp), PACK(asize, 1));
+    PUT(FTRP(bp), PACK(asize, 1));
+    if (fresh)
+		*fresh = 0;
+    return bp;
+}
+#endif /* def MESH */
+
+/*
+ * heap_block - alloc_block from the heap only, never mapped
+ */
+static void *heap_block(size_t size, int *fresh)
+{
+    size_t asize;      /* Adjusted block size */
+    char *bp;      
+
+    /* Adjust block size to include overhead and alignment reqs. */
+    asize = adjust_size(size);
+    if (asize <= conf.small_max && (bp = small_pop(asize)) != NULL)
+		return bp;
+
+    pthread_mutex_lock(&heap_lock);
+    bp = heap_alloc(asize, fresh);
+    pthread_mutex_unlock(&heap_lock);
+    if (__builtin_expect(stats_pending, 0))
+		stats_start(); /* mm_malloc32 comes here directly */
+    return bp;
+}
+
+/*
+ * heap_alloc - allocate an asize block from the heap, lock held
+ */
+static void *heap_alloc(size_t asize, int *fresh)
+{
+    size_t extendsize; /* Amount to extend heap if no fit */
+    size_t wsize;      /* Wilderness size */
+    char *bp;      
+
+    /* Search the free list for a fit */
+    // mm_checkheap(__LINE__);
+    if ((bp = conf.hugepage? huge_fit(asize) : find_fit(asize)) != NULL) {
+    	// mm_checkheap(__LINE__);  
+		place(bp, asize);
+		// mm_checkheap(__LINE__);                   
+		return bp;
+    }
+
+    /* No fit found. Carve it from the wilderness, grow it if needed */
+    wsize = wild? GET_SIZE(HDRP(wild)) : 0;
+    if (wsize < asize) {
+		extendsize = MAX(asize - wsize, conf.chunksize);                 
+		if (extend_heap(extendsize/WSIZE) == NULL)  
+			return NULL;                                
+    }
+    return wild_alloc(asize, fresh);
+} 
+
+/* 
+ * free an allocated block
+ * 1. coalesce with any ajacent free blocks
+ * 2. put it in the beginning of the free list
+ */
+void free(void *bp)
+{
+    if(bp == 0) 
+		return;
+
+    MM_PROBE(dealloc, bp, block_size(bp));
+    MM_HOOK(on_free, bp);
+    free_block(bp);
+}
+
+/*
+ * free_block - release an allocated block, free without the events
+ */
+static void free_block(void *bp)
+{
+    size_t size;
+
+    /* as alloc_block: set up under the lock, not over another engine */
+    if (!heap_ours() || (heap_listp == 0 && malloc_init() == -1))
+		return;
+    size = block_size(bp);
+
+    tag_account(GET_TAG(bp), -(long)size, -1);
+    if (IS_MAPPED(bp)) {
+		map_release(bp);
+		return;
+    }
+#ifdef MESH
+    if (mesh_owns(bp)) {
+		mesh_free(HDRP(bp));
+		return;
+    }
+#endif
+    if (size <= conf.small_max && small_push(bp, size))
+		return;
+
+    pthread_mutex_lock(&heap_lock);
+    PUT(HDRP(bp), PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+
+	/* a large wilderness gives its pages back (M_TRIM_THRESHOLD) */
+	if (coalesce(bp) == wild)
+		trim_wild(conf.top_pad);
+	pthread_mutex_unlock(&heap_lock);
+	// mm_checkheap(__LINE__);
+}
+
+/*
+ * mm_realloc - Naive implementation of realloc
+ * a mapped block that stays large is remapped, never copied
+ */
+void *realloc(void *ptr, size_t size)
+{
+    size_t oldsize;
+    void *newptr;
+
+    /* If size == 0 then this is just free, and we return NULL. */
+    if(size == 0) {
+		free(ptr);
+		return NULL;
+    }
+
+    /* If oldptr is NULL, then this is just malloc. */
+    if(ptr == NULL) {
+		return malloc(size);
+    }
+
+    /* Grow or keep the block in place when the neighbors allow it */
+    if (IS_MAPPED(ptr))
+		newptr = size >= conf.mmap_threshold? 
+		         map_resize(ptr, size, MREMAP_MAYMOVE) : NULL;
+    else
+		newptr = mm_try_expand(ptr, size)? ptr : NULL;
+    if (newptr) {
+		MM_PROBE3(resize, ptr, newptr, size);
+		MM_HOOK(on_realloc, ptr, newptr, size);
+		return newptr;
+    }
+
+    /* The moved block keeps its tag */
+    newptr = tagged_alloc(size, GET_TAG(ptr), NULL);
+
+    /* If realloc() fails the original block is left untouched  */
+    if(!newptr) {
+		return 0;
+    }
+
+    /* Copy the old data. */
+    oldsize = usable_size(ptr);
+    if(size < oldsize) oldsize = size;
+    memcpy(newptr, ptr, oldsize);
+
+    /* Free the old block. */
+    MM_PROBE3(resize, ptr, newptr, size);
+    MM_HOOK(on_realloc, ptr, newptr, size);
+    free_block(ptr);
+
+    return newptr;
+}
+
+/*
+ * calloc - you may want to look at mm-naive.c
+ * This function is not tested by mdriver, but it is
+ * needed to run the traces.
+ */
+void *calloc (size_t nmemb, size_t size) {
+	size_t bytes;
+	char *newptr;
+	int fresh = 0;
+
+	if (nmemb && size > (size_t)-1 / nmemb)
+		return NULL;
+	bytes = nmemb*size;
+
+	newptr = tagged_alloc(bytes, cur_tag, &fresh);
+	if (newptr) {
+		MM_PROBE(alloc, newptr, bytes);
+		MM_HOOK(on_alloc, newptr, bytes);
+		if (!fresh)
+			zero_block(newptr, bytes);
+	}
+
+    return newptr;
+}
+
+/*
+ * mm_malloc_at_least - malloc that also reports the usable size
+ * the block is rounded up to asize, so the caller may use every byte
+ * up to the footer. *usable is left untouched if the allocation fails.
+ */
+void *mm_malloc_at_least(size_t size, size_t *usable)
+{
+	char *bp;
+
+	if ((bp = malloc(size)) != NULL && usable)
+		*usable = usable_size(bp);
+	return bp;
+}
+
+/*
+ * mm_try_expand - grow an allocated block in place, never move it
+ * 1. the block already holds new_size: nothing to do
+ * 2. absorb the next block if it is free and large enough,
+ *    split the remainder back into the free list
+ * 3. the block is the last one in the heap: extend the heap first
+ * return the new usable size, 0 if the block cannot grow in place
+ * (steps 2 and 3 are in expand_block, under the heap lock)
+ * a mapped block grows if its mapping can be extended where it is
+ */
+size_t mm_try_expand(void *ptr, size_t new_size)
+{
+	size_t asize, csize;
+
+	if (ptr == NULL || new_size == 0 || !heap_ours())
+		return 0;
+	if (IS_MAPPED(ptr)) {
+		if (new_size > usable_size(ptr) && !map_resize(ptr, new_size, 0))
+			return 0;
+		return usable_size(ptr);
+	}
+	if (new_size > MAX_SBRK_INCR - conf.chunksize)
+		return 0;
+
+	asize = adjust_size(new_size);
+	csize = GET_SIZE(HDRP(ptr));
+	if (asize <= csize)
+		return csize - DSIZE;
+#ifdef MESH
+	if (mesh_owns(ptr))
+		return 0; /* slots do not grow */
+#endif
+
+	pthread_mutex_lock(&heap_lock);
+	csize = expand_block(ptr, asize);
+	pthread_mutex_unlock(&heap_lock);
+	return csize;
+}
+
+/*
+ * mm_malloc32 - malloc from the heap only, never a mapped block, so
+ * the payload can be named by a 32-bit reference (mm_ref32)
+ */
+void *mm_malloc32(size_t size)
+{
+	char *bp;
+
+	if (!heap_ours() || (heap_listp == 0 && malloc_init() == -1))
+		return NULL;
+	if (size == 0 || size > MAX_SBRK_INCR - conf.chunksize)
+		return NULL;
+	if ((bp = heap_block(size, NULL)) != NULL) {
+		PUT_TAG(bp, cur_tag);
+		tag_account(cur_tag, block_size(bp), 1);
+		MM_PROBE(alloc, bp, size);
+		MM_HOOK(on_alloc, bp, size);
+	}
+	return bp;
+}
+
+/*
+ * mm_malloc_near - malloc preferring a block close to hint
+ * 1. the free block nearest to hint's block among its neighbours
+ *    (near_fit), taken under the heap lock
+ * 2. no such block, or no heap block at hint: the normal search
+ * small blocks come from the neighbours too, not from their stacks
+ */
+void *mm_malloc_near(const void *hint, size_t size)
+{
+	char *bp = NULL;
+	size_t asize;
+
+	if (!heap_ours() || (heap_listp == 0 && malloc_init() == -1))
+		return NULL;
+	if (hint == NULL || size == 0 || size >= conf.mmap_threshold ||
+		size > MAX_SBRK_INCR - conf.chunksize ||
+		(char *)hint <= heap_listp || (char *)hint > (char *)mem_heap_hi())
+		return malloc(size);
+
+	asize = adjust_size(size);
+	pthread_mutex_lock(&heap_lock);
+	bp = near_fit((char *)hint, asize);
+	if (bp != NULL && bp == wild)
+		bp = wild_alloc(asize, NULL);
+	else if (bp != NULL)
+		place(bp, asize);
+	pthread_mutex_unlock(&heap_lock);
+	if (bp == NULL)
+		return malloc(size);
+
+	PUT_TAG(bp, cur_tag);
+	tag_account(cur_tag, block_size(bp), 1);
+	MM_PROBE(alloc, bp, size);
+	MM_HOOK(on_alloc, bp, size);
+	return bp;
+}
+
+/*
+ * mm_block_of - the allocated block containing addr, header included
+ * return its payload and store the usable size in *size (if size is
+ * not NULL), NULL if addr is in no allocated block. Heap blocks are
+ * found through the block start index, mesh blocks through their
+ * page, mapped blocks by a binary search. Blocks parked on the small
+ * stacks count as allocated.
+ */
+void *mm_block_of(const void *addr, size_t *size)
+{
+	char *p = (char *)addr, *bp = NULL;
+	size_t i;
+
+	if (heap_listp && p > heap_listp && p <= (char *)mem_heap_hi()) {
+		pthread_mutex_lock(&heap_lock);
+		bp = idx_find(p + WSIZE);
+		if (bp && (!GET_ALLOC(HDRP(bp)) || p >= HDRP(bp) + GET_SIZE(HDRP(bp))))
+			bp = NULL;
+		if (bp && size)
+			*size = GET_SIZE(HDRP(bp)) - DSIZE;
+		pthread_mutex_unlock(&heap_lock);
+		return bp;
+	}
+#ifdef MESH
+	if (mesh_owns(p)) {
+		if ((bp = mesh_slot_of(p, &i)) == NULL)
+			return NULL;
+		if (size)
+			*size = i - DSIZE;
+		return bp + WSIZE;
+	}
+#endif
+
+	pthread_mutex_lock(&map_cache.lock);
+	i = map_index_pos(p + MAP_OVERHEAD + 1);
+	if (i > 0) {
+		bp = map_cache.index[i - 1];
+		if (p >= bp - MAP_OVERHEAD + MAP_LEN(bp))
+			bp = NULL;
+		else if (size)
+			*size = MAP_LEN(bp) - MAP_OVERHEAD;
+	}
+	pthread_mutex_unlock(&map_cache.lock);
+	return bp;
+}
+
+/*
+ * mm_heap_stats - heap size and free blocks, the wilderness included;
+ * blocks on the small stacks and mappings count as allocated
+ */
+void mm_heap_stats(struct mm_heap_stats *stats)
+{
+	pthread_mutex_lock(&heap_lock);
+	core_heap_stats(heap_listp, stats);
+	pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * mm_check_snapshot - mm_checkheap and a fragmentation analysis of a
+ * copy-on-write snapshot of the heap, in a forked child
+ * 1. flush stdio so the child does not print the parent's output
+ * 2. fork with the heap lock held: the snapshot is between operations
+ * 3. wait for the child's report on a pipe; no report means the
+ *    checker failed (it exits), status gets the child's exit status
+ * return 0 if the child ran, -1 (errno set) if it could not be started,
+ * ENOTSUP for a heap of another engine; a heap not set up yet is set up
+ */
+int mm_check_snapshot(struct mm_snapshot *snap)
+{
+	int fd[2], status = 0, ret;
+	size_t got = 0;
+	ssize_t n;
+	pid_t pid;
+	long left, deadline;
+	struct pollfd pfd;
+
+	memset(snap, 0, sizeof(*snap));
+	if (!heap_ours()) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	if (heap_listp == 0 && malloc_init() == -1) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (pipe(fd) == -1)
+		return -1;
+
+	fflush(NULL);
+	pthread_mutex_lock(&heap_lock);
+	pid = fork();
+	if (pid == 0) {
+		close(fd[0]);
+		snap_child(fd[1]);
+	}
+	pthread_mutex_unlock(&heap_lock);
+	close(fd[1]);
+	if (pid == -1) {
+		close(fd[0]);
+		return -1;
+	}
+
+	/* a child stuck (on a lock some thread held at the fork) is killed */
+	deadline = now_ms() + SNAP_TIMEOUT_MS;
+	pfd.fd = fd[0];
+	pfd.events = POLLIN;
+	while (got < sizeof(*snap)) {
+		if ((left = deadline - now_ms()) <= 0 || 
+			(ret = poll(&pfd, 1, (int)left)) == 0) {
+			kill(pid, SIGKILL);
+			break;
+		}
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		n = read(fd[0], (char *)snap + got, sizeof(*snap) - got);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		got += n;
+	}
+	close(fd[0]);
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+		;
+	if (got != sizeof(*snap)) {
+		memset(snap, 0, sizeof(*snap));
+		snap->status = WIFEXITED(status)? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		if (snap->status == 0)
+			snap->status = 1;
+	}
+	return 0;
+}
+
+/*
+ * mm_set_hooks - register event callbacks, NULL removes them all
+ * the table is copied; unset members are skipped. Meant to be called
+ * before the threads that allocate start, or while they are quiet.
+ */
+void mm_set_hooks(const struct mm_hooks *hooks)
+{
+	__atomic_store_n(&hooks_on, 0, __ATOMIC_RELEASE);
+	if (hooks == NULL)
+		return;
+	hook_table = *hooks;
+	__atomic_store_n(&hooks_on, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * mm_set_tag - set the calling thread's allocation tag
+ * return the previous tag, -1 if tag is out of range
+ */
+int mm_set_tag(int tag)
+{
+	int old = cur_tag;
+
+	if (tag < 0 || tag >= MM_NUM_TAGS)
+		return -1;
+	cur_tag = tag;
+	return old;
+}
+
+/*
+ * mm_get_tag - the calling thread's allocation tag
+ */
+int mm_get_tag(void)
+{
+	return cur_tag;
+}
+
+/*
+ * mm_malloc_tagged - malloc charged to an explicit tag
+ */
+void *mm_malloc_tagged(size_t size, int tag)
+{
+	char *bp;
+
+	if (tag < 0 || tag >= MM_NUM_TAGS)
+		return NULL;
+	bp = tagged_alloc(size, tag, NULL);
+	if (bp) {
+		MM_PROBE(alloc, bp, size);
+		MM_HOOK(on_alloc, bp, size);
+	}
+	return bp;
+}
+
+/*
+ * mm_tag_of - the tag an allocated block is charged to, -1 if ptr is
+ * NULL or another engine's block
+ */
+int mm_tag_of(void *ptr)
+{
+	return ptr && heap_ours()? (int)GET_TAG(ptr) : -1;
+}
+
+/*
+ * mm_tag_stats - live bytes (block sizes) and block count of a tag,
+ * summed over all shards. The sum is not a snapshot: concurrent
+ * updates may or may not be included.
+ * return 0 if success, -1 if tag is out of range or another engine
+ * runs the heap
+ */
+int mm_tag_stats(int tag, struct mm_tag_stats *stats)
+{
+	int i;
+
+	if (tag < 0 || tag >= MM_NUM_TAGS || stats == NULL || !heap_ours())
+		return -1;
+	stats->bytes = 0;
+	stats->count = 0;
+	for (i = 0; i < TAG_SHARDS; i++) {
+		stats->bytes += __atomic_load_n(&tag_stats[i].tag[tag].bytes, 
+		                                __ATOMIC_RELAXED);
+		stats->count += __atomic_load_n(&tag_stats[i].tag[tag].count, 
+		                                __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+/*
+ * mm_epoch_enter - start a read-side section of the calling thread,
+ * sections nest. The thread announces the global epoch it saw; the
+ * fence orders the announcement before the section's reads. A thread
+ * that cannot get a record counts as a blocker instead, which holds
+ * the epoch still for everyone until it leaves.
+ */
+void mm_epoch_enter(void)
+{
+	struct epoch_rec *rec = epoch_rec_get();
+	unsigned long e;
+
+	if (rec == NULL) {
+		if (blocker_nest++ == 0)
+			__atomic_fetch_add(&epoch_blockers, 1, __ATOMIC_SEQ_CST);
+		return;
+	}
+	if (rec->nest++ > 0)
+		return;
+	e = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+	__atomic_store_n(&rec->state, (e << 1) | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * mm_epoch_exit - end a read-side section
+ */
+void mm_epoch_exit(void)
+{
+	struct epoch_rec *rec = my_rec;
+
+	if (blocker_nest > 0) {
+		if (--blocker_nest == 0)
+			__atomic_fetch_sub(&epoch_blockers, 1, __ATOMIC_RELEASE);
+		return;
+	}
+	if (rec == NULL || rec->nest == 0 || --rec->nest > 0)
+		return;
+	__atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * mm_free_deferred - free ptr once no read-side section that may have
+ * seen it is left. The block joins the calling thread's open batch;
+ * a full batch is sealed, and the thread's batches whose grace period
+ * has passed are freed.
+ */
+void mm_free_deferred(void *ptr)
+{
+	struct epoch_rec *rec;
+
+	if (ptr == NULL)
+		return;
+	if ((rec = epoch_rec_get()) == NULL) {
+		/* no record of its own: retire to the shared one */
+		pthread_mutex_lock(&epoch_shared_lock);
+		epoch_retire(&epoch_shared, ptr);
+		pthread_mutex_unlock(&epoch_shared_lock);
+		return;
+	}
+	epoch_retire(rec, ptr);
+}
+
+/*
+ * mm_epoch_reclaim - seal the calling thread's open batch and free
+ * every batch whose grace period has passed, those of exited threads
+ * included. Return the blocks freed.
+ */
+size_t mm_epoch_reclaim(void)
+{
+	struct epoch_rec *rec = epoch_rec_get();
+	size_t n = 0;
+
+	if (rec && rec->open.count)
+		epoch_seal(rec);
+	epoch_advance();
+	if (rec)
+		n += epoch_reclaim(rec);
+	for (rec = __atomic_load_n(&epoch_recs, __ATOMIC_ACQUIRE); rec; 
+	     rec = rec->next) {
+		int idle = 0;
+
+		if (!__atomic_compare_exchange_n(&rec->in_use, &idle, 1, 0,
+		                                 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+		n += epoch_reclaim(rec);
+		__atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_lock(&epoch_shared_lock);
+	if (epoch_shared.open.count)
+		epoch_seal(&epoch_shared);
+	n += epoch_reclaim(&epoch_shared);
+	pthread_mutex_unlock(&epoch_shared_lock);
+	return n;
+}
+
+/*
+ * mm_epoch_barrier - wait until every read-side section open now has
+ * ended (the epoch moves on twice). Must not be called inside one.
+ */
+void mm_epoch_barrier(void)
+{
+	unsigned long target = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) + 2;
+
+	while (__atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) < target)
+		if (!epoch_advance())
+			sched_yield();
+}
+
+/*
+ * mm_epoch_stats - the global epoch and the memory retired, not freed
+ */
+void mm_epoch_stats(struct mm_epoch_stats *stats)
+{
+	stats->epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+	stats->retired_bytes = __atomic_load_n(&retired_bytes, __ATOMIC_RELAXED);
+	stats->retired_blocks = __atomic_load_n(&retired_blocks, __ATOMIC_RELAXED);
+	stats->freed_blocks = __atomic_load_n(&retired_freed, __ATOMIC_RELAXED);
+}
+
+/*
+ * mm_reserve - pre-warm the heap with at least bytes of free memory
+ * 1. extend the heap by bytes, the new memory joins the top free block
+ * 2. MM_RESERVE_PREFAULT: write one word in every new page so the
+ *    page faults are taken now instead of on the first requests
+ * 3. MM_RESERVE_MLOCK: lock the new pages so they are never paged out
+ * return 0 if success, -1 if the heap did not grow, MM_RESERVE_NOLOCK
+ * if it grew but mlock failed
+ */
+int mm_reserve(size_t bytes, int flags)
+{
+	char *old_brk, *bp, *p, *end;
+	size_t pagesize = mem_pagesize();
+
+	if (!heap_ours() || (heap_listp == 0 && malloc_init() == -1))
+		return -1;
+	if (bytes == 0 || bytes > MAX_SBRK_INCR - conf.chunksize)
+		return -1;
+
+	pthread_mutex_lock(&heap_lock);
+	old_brk = (char *)mem_heap_hi() + 1;
+	bytes = ALIGN(bytes);
+	if ((bp = extend_heap(bytes/WSIZE)) == NULL) {
+		pthread_mutex_unlock(&heap_lock);
+		return -1;
+	}
+	end = (char *)mem_heap_hi() + 1;
+
+	if (flags & MM_RESERVE_PREFAULT) {
+		/* 
+		 * the new memory is interior of a free block: skip the
+		 * free list links and the footer, anything else is scratch
+		 */
+		p = (char *)ALIGN(MAX(old_brk, (char *)bp + DSIZE));
+		for (; p < FTRP(bp); p += pagesize)
+			*(volatile char *)p = 0;
+	}
+	pthread_mutex_unlock(&heap_lock);
+	if (flags & MM_RESERVE_MLOCK) {
+		p = (char *)((size_t)old_brk & ~(pagesize-1));
+		if (mlock(p, end - p) == -1)
+			return MM_RESERVE_NOLOCK; /* the memory stays in the heap */
+	}
+	return 0;
+}
+
+/*
+ * mallinfo2 - glibc compatible statistics, from a walk of the heap
+ * arena/fordblks/uordblks: heap, free and used bytes
+ * ordblks: free blocks (list + wilderness)
+ * smblks/fsmblks: blocks and bytes parked on the small block stacks,
+ *                 counted as free like glibc's fastbins
+ * keepcost: wilderness size, what malloc_trim can release
+ * hblks/hblkhd: mapped blocks in use and their bytes
+ */
+struct mallinfo2 mallinfo2(void)
+{
+	struct mallinfo2 mi;
+	struct mm_heap_stats st;
+	int i;
+
+	memset(&mi, 0, sizeof(mi));
+	if (heap_listp == 0 || !heap_ours())
+		return mi;
+
+	pthread_mutex_lock(&heap_lock);
+	core_heap_stats(heap_listp, &st);
+	mi.arena = st.heap_bytes;
+	mi.ordblks = st.free_blocks;
+	mi.fordblks = st.free_bytes;
+	for (i = 0; i < NUM_SMALL; i++) {
+		mi.smblks += small_count[i];
+		mi.fsmblks += (size_t)small_count[i] * (MIN_BLK_SIZE + i*DSIZE);
+	}
+	mi.fordblks += mi.fsmblks;
+	mi.uordblks = mi.arena - mi.fordblks;
+	mi.keepcost = wild? GET_SIZE(HDRP(wild)) : 0;
+	pthread_mutex_unlock(&heap_lock);
+	pthread_mutex_lock(&map_cache.lock);
+	mi.hblks = map_cache.live;
+	mi.hblkhd = map_cache.live_bytes;
+	pthread_mutex_unlock(&map_cache.lock);
+	return mi;
+}
+
+/*
+ * mallopt - glibc compatible tuning
+ * M_TRIM_THRESHOLD: wilderness size above which free releases pages
+ * M_TOP_PAD: bytes of the wilderness kept when releasing
+ * M_MMAP_THRESHOLD: requests of this size and up are mapped
+ * M_ARENA_MAX: there is a single heap, any limit of at least 1 holds
+ * return 1 if success, 0 (errno EINVAL) for a bad value or an option
+ * the allocator does not implement, 0 (errno ENOTSUP) if another
+ * engine runs the heap
+ */
+int mallopt(int param, int value)
+{
+	if (!heap_ours()) {
+		errno = ENOTSUP;
+		return 0;
+	}
+	switch (param) {
+	case M_TRIM_THRESHOLD:
+		if (value < 0)
+			break;
+		conf.trim_threshold = value;
+		return 1;
+	case M_TOP_PAD:
+		if (value < 0)
+			break;
+		conf.top_pad = value;
+		return 1;
+	case M_MMAP_THRESHOLD:
+		if (value < 0)
+			break;
+		conf.mmap_threshold = value;
+		return 1;
+	case M_ARENA_MAX:
+		if (value < 1)
+			break;
+		return 1;
+	default:
+		break;
+	}
+	errno = EINVAL;
+	return 0;
+}
+
+/*
+ * malloc_trim - give free pages back to the OS, keeping pad bytes
+ * of the wilderness. The heap cannot shrink, so pages are released
+ * with madvise and fault back in as zero pages when reused: the
+ * wilderness beyond pad and the interior of every listed free block.
+ * Cached mappings are unmapped.
+ * return 1 if any memory was released, 0 otherwise
+ */
+int malloc_trim(size_t pad)
+{
+	size_t released = 0;
+	char *bp;
+
+	if (!heap_ours())
+		return 0;
+
+	pthread_mutex_lock(&map_cache.lock);
+	released = map_cache.bytes;
+	while (map_cache.n > 0) {
+		map_cache.n--;
+		map_unmap(map_cache.slot[map_cache.n].start, 
+		          map_cache.slot[map_cache.n].len);
+	}
+	map_cache.bytes = 0;
+	pthread_mutex_unlock(&map_cache.lock);
+#ifdef PAGEHEAP
+	released += ph_release();
+#endif
+#ifdef MESH
+	released += mesh_compact();
+#endif
+	if (heap_listp == 0)
+		return released > 0;
+
+	pthread_mutex_lock(&heap_lock);
+	for (bp = root; bp; bp = get_next_free(bp))
+		released += release_pages((char *)bp + DSIZE, FTRP(bp), mem_pagesize());
+	if (wild) {
+		heap_released = 0;
+		released += release_pages((char *)wild + DSIZE + pad, FTRP(wild),
+		                          mem_pagesize());
+		heap_released = (char *)wild + DSIZE + pad;
+	}
+	pthread_mutex_unlock(&heap_lock);
+	return released > 0;
+}
+
+/*
+ * malloc_stats - print statistics to stderr, in glibc's format
+ */
+void malloc_stats(void)
+{
+	struct mallinfo2 mi = mallinfo2();
+	char buf[512]; /* fits every key, stats= path at its 127 max included */
+
+	fprintf(stderr, "Arena 0:\n");
+	fprintf(stderr, "system bytes     = %10zu\n", mi.arena);
+	fprintf(stderr, "in use bytes     = %10zu\n", mi.uordblks);
+	fprintf(stderr, "Total (incl. mmap):\n");
+	fprintf(stderr, "system bytes     = %10zu\n", mi.arena + mi.hblkhd);
+	fprintf(stderr, "in use bytes     = %10zu\n", mi.uordblks + mi.hblkhd);
+	fprintf(stderr, "max mmap regions = %10zu\n", mi.hblks);
+	fprintf(stderr, "max mmap bytes   = %10zu\n", mi.hblkhd);
+	mm_conf_string(buf, sizeof(buf));
+	fprintf(stderr, "config: %s\n", buf);
+#ifdef PAGEHEAP
+	{
+		struct ph_stats ph;
+
+		ph_get_stats(&ph);
+		fprintf(stderr, "page heap: used %zu (%zu spans), free %zu (%zu spans),"
+		        " dirty %zu, released %zu\n", ph.used_bytes, ph.used_spans,
+		        ph.free_bytes, ph.free_spans, ph.dirty_bytes, ph.released_bytes);
+	}
+#endif
+#ifdef MESH
+	{
+		struct mesh_stats ms;
+
+		mesh_get_stats(&ms);
+		fprintf(stderr, "mesh: %zu pages on %zu, in use %zu, meshed %zu,"
+		        " released %zu\n", ms.pages, ms.phys_pages, ms.used_bytes,
+		        ms.meshes, ms.released);
+	}
+#endif
+	{
+		struct mm_epoch_stats es;
+
+		mm_epoch_stats(&es);
+		fprintf(stderr, "epoch %lu: retired %zu (%zu blocks), freed %zu"
+		        " blocks\n", es.epoch, es.retired_bytes, es.retired_blocks,
+		        es.freed_blocks);
+	}
+}
+
+/*
+ * mm_conf_string - write the effective configuration to buf, in the
+ * MM_CONF syntax. Return the length it needs, like snprintf.
+ */
+size_t mm_conf_string(char *buf, size_t len)
+{
+	if (!conf_loaded)
+		conf_load();
+	return snprintf(buf, len, 
+	                "chunk=%zu,trim_threshold=%zu,top_pad=%zu,small_max=%zu,"
+	                "small_cache=%u,zero_min=%zu,policy=%s,mmap_threshold=%zu,"
+	                "map_cache=%zu,decay_ms=%ld,map_lazy=%d,hugepage=%d,stats=%s,"
+	                "stats_ms=%ld",
+	                conf.chunksize, conf.trim_threshold, conf.top_pad,
+	                conf.small_max, conf.small_cache, conf.zero_min,
+	                policy_names[conf.policy], conf.mmap_threshold,
+	                conf.map_cache, conf.decay_ms, conf.map_lazy,
+	                conf.hugepage, conf.stats_path, conf.stats_ms);
+}
+
+/* 
+ * The remaining routines are internal helper routines 
+ */
+
+/*
+ * expand_block - grow allocated block ptr to asize in place, lock held
+ * return the new usable size, 0 if the neighbors do not allow it
+ */
+static size_t expand_block(void *ptr, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(ptr));
+	size_t nsize;
+	char *next = NEXT_BLKP(ptr);
+	int tag, was_wild;
+
+	nsize = csize;
+	if (!GET_ALLOC(HDRP(next)))
+		nsize += GET_SIZE(HDRP(next));
+
+	/* top of the heap: ask for the missing bytes, they join the wilderness */
+	if (nsize < asize && (GET_SIZE(HDRP(next)) == 0 || 
+		(!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0))) {
+		if (extend_heap(MAX(asize - nsize, conf.chunksize)/WSIZE) == NULL)
+			return 0;
+		next = NEXT_BLKP(ptr);
+		nsize = csize + GET_SIZE(HDRP(next));
+	}
+	if (nsize < asize)
+		return 0;
+
+	/* absorb the next free block */
+	tag = GET_TAG(ptr);
+	if ((was_wild = (next == wild)))
+		wild = NULL;
+	else
+		deleteFree(next);
+	idx_clear(next);
+	if ((nsize - asize) >= MIN_BLK_SIZE) {
+		PUT(HDRP(ptr), PACK(asize, 1));
+		PUT(FTRP(ptr), PACK(asize, 1));
+		next = NEXT_BLKP(ptr);
+		PUT(HDRP(next), PACK(nsize-asize, 0));
+		PUT(FTRP(next), PACK(nsize-asize, 0));
+		idx_set(next);
+		release_free(next);
+	}
+	else {
+		PUT(HDRP(ptr), PACK(nsize, 1));
+		PUT(FTRP(ptr), PACK(nsize, 1));
+	}
+	PUT_TAG(ptr, tag);
+	/* all of the block is handed out, a leftover under MIN_BLK_SIZE too */
+	if (was_wild) {
+		heap_clean = MAX(heap_clean, NEXT_BLKP(ptr));
+		if (heap_released)
+			heap_released = MAX(heap_released, NEXT_BLKP(ptr));
+	}
+	tag_account(tag, GET_SIZE(HDRP(ptr)) - csize, 0);
+	return GET_SIZE(HDRP(ptr)) - DSIZE;
+}
+
+/*
+ * small_pop - pop a block of exactly asize bytes off its stack
+ * the next link of the top block is read before the CAS; if another
+ * thread popped and reused it meanwhile, the version has moved on
+ * and the CAS fails. Return NULL if the stack is empty.
+ */
+static void *small_pop(size_t asize)
+{
+	unsigned long *headp = &small_head[SMALL_IDX(asize)];
+	unsigned long head, new_head;
+	char *bp;
+
+	head = __atomic_load_n(headp, __ATOMIC_ACQUIRE);
+	do {
+		if (HEAD_OFF(head) == 0)
+			return NULL;
+		bp = itop(HEAD_OFF(head));
+		new_head = MAKE_HEAD(GET(bp), HEAD_VER(head) + 1);
+	} while (!__atomic_compare_exchange_n(headp, &head, new_head, 1,
+	                                      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+	__atomic_fetch_sub(&small_count[SMALL_IDX(asize)], 1, __ATOMIC_RELAXED);
+	return bp;
+}
+
+/*
+ * small_push - push an allocated block of size bytes on its stack
+ * the link to the old top goes in the first payload word, the block
+ * stays allocated in the heap so coalescing never sees it.
+ * Return 0 if the stack is full and the block must be freed normally.
+ */
+static int small_push(void *bp, size_t size)
+{
+	unsigned long *headp = &small_head[SMALL_IDX(size)];
+	unsigned long head, new_head;
+
+	if (__atomic_load_n(&small_count[SMALL_IDX(size)], __ATOMIC_RELAXED) 
+		>= conf.small_cache)
+		return 0;
+	__atomic_fetch_add(&small_count[SMALL_IDX(size)], 1, __ATOMIC_RELAXED);
+
+	head = __atomic_load_n(headp, __ATOMIC_RELAXED);
+	do {
+		PUT(bp, HEAD_OFF(head));
+		new_head = MAKE_HEAD(ptoi(bp), HEAD_VER(head) + 1);
+	} while (!__atomic_compare_exchange_n(headp, &head, new_head, 1,
+	                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	return 1;
+}
+
+/*
+ * Parallel zeroing pool for large calloc blocks. One job at a time:
+ * the range is cut in PAR_ZERO_PART parts that the caller and the
+ * workers claim with a CAS on a counter that carries the job's
+ * generation, so a late worker of an older job cannot claim a part of
+ * the new one. Each part is first touched by
+ * the thread that zeroes it, so on NUMA systems the pages of a fresh
+ * block get spread over the nodes the workers run on.
+ */
+static struct {
+	pthread_mutex_t job_lock;  /* one job at a time */
+	pthread_mutex_t lock;      /* protects the fields below */
+	pthread_cond_t work;       /* a new job was posted */
+	pthread_cond_t done;       /* the last part of the job finished */
+	int nthreads;              /* workers started, -1 if none possible */
+	unsigned long gen;         /* job generation */
+	char *base;
+	size_t len;
+	unsigned int nparts;
+	unsigned long claim;       /* gen << 32 | next part to claim */
+	unsigned int finished;     /* parts of this job finished */
+} zero_pool = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * zero_parts - claim and zero parts of the current job until none left
+ */
+static void zero_parts(void)
+{
+	unsigned long claim;
+	unsigned int i, nparts;
+	size_t off;
+
+	claim = __atomic_load_n(&zero_pool.claim, __ATOMIC_ACQUIRE);
+	for (;;) {
+		/*
+		 * nparts may already be the next job's if this one is all
+		 * claimed; the CAS then fails on the generation
+		 */
+		i = (unsigned int)claim;
+		nparts = __atomic_load_n(&zero_pool.nparts, __ATOMIC_RELAXED);
+		if (i >= nparts)
+			return;
+		if (!__atomic_compare_exchange_n(&zero_pool.claim, &claim, claim + 1,
+		                                 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+			continue;
+		/* the job cannot change while a part of it is unfinished */
+		off = (size_t)i * PAR_ZERO_PART;
+		memset(zero_pool.base + off, 0, 
+		       MIN(PAR_ZERO_PART, zero_pool.len - off));
+		claim++;
+		if (__atomic_add_fetch(&zero_pool.finished, 1, __ATOMIC_ACQ_REL) 
+			== nparts) {
+			pthread_mutex_lock(&zero_pool.lock);
+			pthread_cond_signal(&zero_pool.done);
+			pthread_mutex_unlock(&zero_pool.lock);
+		}
+	}
+}
+
+/*
+ * zero_worker - pool thread: wait for a job generation, help zero it
+ */
+static void *zero_worker(void *arg)
+{
+	unsigned long seen = 0;
+
+	(void)arg;
+	pthread_mutex_lock(&zero_pool.lock);
+	for (;;) {
+		while (zero_pool.gen == seen)
+			pthread_cond_wait(&zero_pool.work, &zero_pool.lock);
+		seen = zero_pool.gen;
+		pthread_mutex_unlock(&zero_pool.lock);
+		zero_parts();
+		pthread_mutex_lock(&zero_pool.lock);
+	}
+	return NULL;
+}
+
+/*
+ * zero_pool_start - start the workers on first use, one per extra CPU
+ * return the number of workers
+ */
+static int zero_pool_start(void)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t tid;
+	int n;
+
+	if (zero_pool.nthreads != 0)
+		return zero_pool.nthreads;
+	zero_pool.nthreads = -1;
+	for (n = 0; n < MIN(ncpu - 1, PAR_ZERO_THREADS); n++) {
+		if (pthread_create(&tid, NULL, zero_worker, NULL) != 0)
+			break;
+		pthread_detach(tid);
+		zero_pool.nthreads = n + 1;
+	}
+	return zero_pool.nthreads;
+}
+
+/*
+ * zero_block - zero bytes at bp, large blocks with the worker pool
+ * falls back to a plain memset for small blocks, when the pool is
+ * busy with another block, or when there is only one CPU
+ */
+static void zero_block(void *bp, size_t bytes)
+{
+	if (bytes < conf.zero_min || pthread_mutex_trylock(&zero_pool.job_lock)) {
+		memset(bp, 0, bytes);
+		return;
+	}
+	if (zero_pool_start() <= 0) {
+		pthread_mutex_unlock(&zero_pool.job_lock);
+		memset(bp, 0, bytes);
+		return;
+	}
+
+	/* post the job */
+	pthread_mutex_lock(&zero_pool.lock);
+	zero_pool.base = bp;
+	zero_pool.len = bytes;
+	__atomic_store_n(&zero_pool.nparts, 
+	                 (bytes + PAR_ZERO_PART - 1) / PAR_ZERO_PART, __ATOMIC_RELAXED);
+	zero_pool.finished = 0;
+	/* claims of the last job fail from here on, a late worker may claim */
+	zero_pool.gen++;
+	__atomic_store_n(&zero_pool.claim, zero_pool.gen << 32, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&zero_pool.work);
+	pthread_mutex_unlock(&zero_pool.lock);
+
+	/* help, then wait for the parts still in the workers' hands */
+	zero_parts();
+	pthread_mutex_lock(&zero_pool.lock);
+	while (__atomic_load_n(&zero_pool.finished, __ATOMIC_ACQUIRE) 
+		   < zero_pool.nparts)
+		pthread_cond_wait(&zero_pool.done, &zero_pool.lock);
+	pthread_mutex_unlock(&zero_pool.lock);
+	pthread_mutex_unlock(&zero_pool.job_lock);
+}
+
+/*
+ * tag_account - add bytes and count to a tag in this thread's shard
+ * a thread picks its shard on first use, shards wrap around when
+ * there are more threads than shards, hence the atomic adds
+ */
+static void tag_account(int tag, long bytes, long count)
+{
+	struct mm_tag_stats *ts;
+
+	if (tag_shard < 0)
+		tag_shard = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) 
+		            % TAG_SHARDS;
+	ts = &tag_stats[tag_shard].tag[tag];
+	__atomic_fetch_add(&ts->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ts->count, count, __ATOMIC_RELAXED);
+	if (count > 0)
+		__atomic_fetch_add(&tag_stats[tag_shard].allocs, count, 
+		                   __ATOMIC_RELAXED);
+}
+
+/*
+ * adjust_size - block size for a request of size payload bytes,
+ * including header/footer overhead and alignment
+ */
+static size_t adjust_size(size_t size)
+{
+    if (size <= DSIZE)
+		return 2*DSIZE;
+    return ALIGN(size + DSIZE);
+}
+
+/* 
+ * extend_heap - Extend heap with free block and return its block pointer
+ * the new memory is always the wilderness, merged with the old one
+ */
+
+static void *extend_heap(size_t words) 
+{
+    char *bp;
+    size_t size;
+
+    /* Allocate an even number of words (ALIGNMENT) to maintain alignment */
+    size = ALIGN(words * WSIZE); 
+    /* hugepage: end the heap on a huge page boundary */
+    if (conf.hugepage)
+		size = HUGE_UP((char *)mem_heap_hi() + 1 + size) - 
+		       ((char *)mem_heap_hi() + 1);
+    /* links and mm_ref32 references are 32-bit: stay within 4 GB */
+    if (size > MAX_SBRK_INCR || mem_heapsize() + size > 0xffffffffUL)
+		return NULL;
+    if ((long)(bp = mem_sbrk(size)) == -1)  
+		return NULL;                                        
+    if (conf.hugepage && HUGE_UP(bp) < (char *)bp + size)
+		madvise(HUGE_UP(bp), (char *)bp + size - HUGE_UP(bp), MADV_HUGEPAGE);
+    /* Initialize free block header/footer and the epilogue header */
+    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */   
+    PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */   
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */ 
+    MM_PROBE(grow, bp, size);
+    MM_HOOK(on_grow, bp, size);
+	
+    /* Merge with the wilderness, the only free block that can precede */
+    if (wild) {
+		/* old footer and new header become interior: keep them zero */
+		PUT(HDRP(bp), 0);
+		PUT(FTRP(wild), 0);
+		size += GET_SIZE(HDRP(wild));
+		bp = wild;
+		PUT(HDRP(bp), PACK(size, 0));
+		PUT(FTRP(bp), PACK(size, 0));
+    }
+    else {
+		idx_set(bp);
+		/* first chunk: nothing handed out yet */
+		if (heap_clean == 0)
+			heap_clean = bp;
+    }
+    wild = bp;
+    return bp;                                         
+}
+
+/*
+ * wild_alloc - allocate asize bytes from the start of the wilderness
+ * no list operations: the wilderness start is bumped past the block,
+ * the caller makes sure the wilderness is large enough.
+ * Above heap_clean the wilderness is zero except its own header and
+ * footer, which are never part of a payload: such blocks are fresh.
+ */
+static void *wild_alloc(size_t asize, int *fresh)
+{
+    char *bp = wild;
+    size_t csize = GET_SIZE(HDRP(bp));
+
+#ifdef SBRK_ZEROED
+    if (fresh)
+		*fresh = (bp >= heap_clean);
+#else
+    (void)fresh;
+#endif
+
+    if ((csize - asize) >= MIN_BLK_SIZE) {
+		PUT(HDRP(bp), PACK(asize, 1));
+		PUT(FTRP(bp), PACK(asize, 1));
+		wild = NEXT_BLKP(bp);
+		PUT(HDRP(wild), PACK(csize-asize, 0));
+		PUT(FTRP(wild), PACK(csize-asize, 0));
+		idx_set(wild);
+    }
+    else {
+		PUT(HDRP(bp), PACK(csize, 1));
+		PUT(FTRP(bp), PACK(csize, 1));
+		wild = NULL;
+    }
+    heap_clean = MAX(heap_clean, NEXT_BLKP(bp));
+    if (heap_released)
+		heap_released = MAX(heap_released, NEXT_BLKP(bp));
+    return bp;
+}
+
+/*
+ * near_fit - a free block of at least asize near the block holding
+ * hint, lock held: walk outwards from it both ways, one block per side
+ * per step, and return the first fit. NULL if none within NEAR_STEPS
+ * blocks and NEAR_SPAN bytes. Free heap blocks are listed blocks or
+ * the wilderness; stacked small blocks look allocated and are skipped.
+ */
+static void *near_fit(char *hint, size_t asize)
+{
+	char *home, *next, *prev;
+	int i;
+
+	if ((home = idx_find(hint + WSIZE)) == NULL)
+		return NULL;
+	next = prev = home;
+	for (i = 0; i < NEAR_STEPS; i++) {
+		if (next != NULL) {
+			next = NEXT_BLKP(next);
+			if (GET_SIZE(HDRP(next)) == 0 || next - home > NEAR_SPAN)
+				next = NULL;
+			else if (!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(next)) >= asize)
+				return next;
+		}
+		if (prev != NULL) {
+			prev = PREV_BLKP(prev);
+			if (prev == heap_listp || home - prev > NEAR_SPAN)
+				prev = NULL;
+			else if (!GET_ALLOC(HDRP(prev)) && GET_SIZE(HDRP(prev)) >= asize)
+				return prev;
+		}
+		if (next == NULL && prev == NULL)
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * snap_child - the mm_check_snapshot child: check the heap, walk it
+ * for the report, write the report to fd and exit. Another thread may
+ * have held the stdio locks at the fork, so the child only uses
+ * write(2) and _exit: the checker runs quiet and a failed check comes
+ * back here as a report with status 1.
+ */
+static void snap_child(int fd)
+{
+	struct mm_snapshot snap;
+	struct mm_heap_stats st;
+	long t0 = now_ms();
+	size_t size;
+	char *bp;
+	int bin;
+
+	memset(&snap, 0, sizeof(snap));
+	check_quiet = 1;
+	if (setjmp(check_jmp)) {
+		memset(&snap, 0, sizeof(snap));
+		snap.status = 1;
+		snap_send(fd, &snap);
+	}
+	mm_checkheap(__LINE__);
+
+	core_heap_stats(heap_listp, &st);
+	snap.heap_bytes = st.heap_bytes;
+	snap.free_blocks = st.free_blocks;
+	snap.free_bytes = st.free_bytes;
+	snap.largest_free = st.largest_free;
+	for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+		size = GET_SIZE(HDRP(bp));
+		if (GET_ALLOC(HDRP(bp))) {
+			snap.alloc_blocks++;
+			snap.alloc_bytes += size;
+		}
+		else {
+			bin = 63 - __builtin_clzll(size);
+			snap.free_hist[MIN(bin, MM_SNAP_BINS - 1)]++;
+		}
+	}
+	snap.check_ms = now_ms() - t0;
+	snap_send(fd, &snap);
+}
+
+/*
+ * snap_send - write the report to fd and leave the child, without the
+ * parent's atexit work
+ */
+static void snap_send(int fd, struct mm_snapshot *snap)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < sizeof(*snap)) {
+		n = write(fd, (char *)snap + off, sizeof(*snap) - off);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		off += n;
+	}
+	_exit(snap->status);
+}
+
+/*
+ * conf_size - parse a size value with an optional K, M or G suffix
+ * return 0 if success, -1 if the value is malformed or does not fit
+ * a size_t
+ */
+static int conf_size(const char *val, size_t len, size_t *out)
+{
+    char *end;
+    unsigned long long v;
+    int shift = 0, saved = errno, range;
+
+    if (len == 0 || *val < '0' || *val > '9')
+		return -1;
+    errno = 0;
+    v = strtoull(val, &end, 10);
+    range = errno == ERANGE;
+    errno = saved; /* the caller's, malloc leaves it alone on success */
+    if (range)
+		return -1;
+    switch (end < val + len ? *end : 0) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    default: break;
+    }
+    if (end != val + len || v > SIZE_MAX >> shift)
+		return -1;
+    *out = (size_t)v << shift;
+    return 0;
+}
+
+/*
+ * conf_set - apply one key=value pair of MM_CONF
+ * return 0 if success, -1 if the key is unknown or the value bad
+ */
+static int conf_set(const char *key, size_t klen, const char *val, size_t vlen)
+{
+    size_t v;
+    int i;
+
+#define KEY_IS(name) (klen == sizeof(name) - 1 && !strncmp(key, name, klen))
+    if (KEY_IS("policy")) {
+		for (i = 0; i < 3; i++) {
+			if (vlen == strlen(policy_names[i]) && 
+				!strncmp(val, policy_names[i], vlen)) {
+				conf.policy = i;
+				return 0;
+			}
+		}
+		return -1;
+    }
+    if (KEY_IS("stats")) {
+		if (vlen >= sizeof(conf.stats_path))
+			return -1;
+		memcpy(conf.stats_path, val, vlen);
+		conf.stats_path[vlen] = 0;
+		stats_pending = (vlen > 0);
+		return 0;
+    }
+    if (conf_size(val, vlen, &v) == -1)
+		return -1;
+    if (KEY_IS("chunk")) {
+		if (v < MIN_BLK_SIZE || v > MAX_SBRK_INCR / 2)
+			return -1;
+		conf.chunksize = ALIGN(v);
+    }
+    else if (KEY_IS("trim_threshold"))
+		conf.trim_threshold = v;
+    else if (KEY_IS("top_pad"))
+		conf.top_pad = v;
+    else if (KEY_IS("small_max")) {
+		/* the stacks are sized at compile time, 0 turns them off */
+		if (v > SMALL_MAX)
+			return -1;
+		conf.small_max = v;
+    }
+    else if (KEY_IS("small_cache"))
+		conf.small_cache = v;
+    else if (KEY_IS("zero_min"))
+		conf.zero_min = v;
+    else if (KEY_IS("mmap_threshold"))
+		conf.mmap_threshold = v;
+    else if (KEY_IS("map_cache"))
+		conf.map_cache = v;
+    else if (KEY_IS("decay_ms"))
+		conf.decay_ms = v;
+    else if (KEY_IS("map_lazy"))
+		conf.map_lazy = (v != 0);
+    else if (KEY_IS("hugepage"))
+		conf.hugepage = (v != 0);
+    else if (KEY_IS("stats_ms")) {
+		if (v == 0)
+			return -1;
+		conf.stats_ms = v;
+    }
+    else
+		return -1;
+#undef KEY_IS
+    return 0;
+}
+
+/*
+ * conf_load - read MM_CONF once: comma separated key=value pairs,
+ * a bad pair is reported on stderr and skipped
+ */
+static void conf_load(void)
+{
+    const char *p, *eq, *end;
+
+    conf_loaded = 1;
+    if ((p = getenv("MM_CONF")) == NULL)
+		return;
+    for (; *p; p = *end ? end + 1 : end) {
+		if ((end = strchr(p, ',')) == NULL)
+			end = p + strlen(p);
+		if (end == p)
+			continue;
+		eq = memchr(p, '=', end - p);
+		if (eq == NULL || conf_set(p, eq - p, eq + 1, end - eq - 1) == -1)
+			fprintf(stderr, "mm: bad MM_CONF entry '%.*s'\n", 
+			        (int)(end - p), p);
+    }
+}
+
+/*
+ * release_pages - madvise away the whole units (pages or huge pages)
+ * inside [lo, hi)
+ * return the number of bytes released
+ */
+static size_t release_pages(char *lo, char *hi, size_t unit)
+{
+    lo = (char *)(((size_t)lo + unit-1) & ~(unit-1));
+    hi = (char *)((size_t)hi & ~(unit-1));
+    if (hi <= lo || madvise(lo, hi - lo, MADV_DONTNEED) == -1)
+		return 0;
+    MM_PROBE(purge, lo, hi - lo);
+    MM_HOOK(on_purge, lo, hi - lo);
+    return hi - lo;
+}
+
+/*
+ * block_size - size of an allocated block, including its overhead
+ */
+static size_t block_size(void *bp)
+{
+    return IS_MAPPED(bp)? MAP_LEN(bp) : GET_SIZE(HDRP(bp));
+}
+
+/*
+ * usable_size - payload bytes of an allocated block
+ */
+static size_t usable_size(void *bp)
+{
+    return IS_MAPPED(bp)? MAP_LEN(bp) - MAP_OVERHEAD 
+                        : GET_SIZE(HDRP(bp)) - DSIZE;
+}
+
+/*
+ * now_ms - monotonic clock in milliseconds, for the mapping cache
+ */
+static long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/*
+ * map_unmap - give a mapping back to the OS
+ */
+static void map_unmap(char *start, size_t len)
+{
+#ifdef PAGEHEAP
+    ph_free(start);
+#else
+    munmap(start, len);
+#endif
+    MM_PROBE(purge, start, len);
+    MM_HOOK(on_purge, start, len);
+}
+
+/*
+ * map_pages - len bytes (a page multiple) of new memory for a mapped
+ * block, NULL if none; *zero is set if the memory is known zero
+ */
+static char *map_pages(size_t len, int *zero)
+{
+    char *start;
+
+#ifdef PAGEHEAP
+    start = ph_alloc(len, 0, zero);
+#else
+    start = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (start == MAP_FAILED)
+		return NULL;
+    *zero = 1;
+#endif
+    return start;
+}
+
+/* map_shrink - give back the memory of a mapped block beyond need */
+static void map_shrink(char *start, size_t len, size_t need)
+{
+#ifdef PAGEHEAP
+    (void)len;
+    ph_resize(start, need);
+#else
+    munmap(start + need, len - need);
+#endif
+}
 
-/* 
- * mm_init - Initialize the memory manager,
- * return 0 if success, -1 if error.
- * 1. start with 4-word structure (padding+proglogue+epilogue)
- * 2. insert a free block with CHUNKSIZE
- * 3. point the chunk to previous and next free blocks
- * 4. initialize root and heap_base address
+/*
+ * map_remap - resize the memory of a mapped block to need bytes, as
+ * mremap does: MREMAP_MAYMOVE in flags lets it move
+ * return the (possibly moved) start, MAP_FAILED if it cannot resize
  */
-int mm_init(void) 
+static char *map_remap(char *start, size_t len, size_t need, int flags)
 {
-    /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1) 
-		return -1;
-	/* Get the heap base address */
-	heap_base = heap_listp;
-	/* Initialize root */
-	root = 0;
-    PUT(heap_listp, 0);                          /* Alignment padding */
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
-    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1));     /* Epilogue header */
-    heap_listp += (2*WSIZE);                     //line:vm:mm:endinit  
-
-#ifdef NEXT_FIT
-    rover = heap_listp;
+#ifdef PAGEHEAP
+    char *moved;
+
+    if (ph_resize(start, need) == 0)
+		return start;
+    if (!(flags & MREMAP_MAYMOVE) || (moved = ph_alloc(need, 0, NULL)) == NULL)
+		return MAP_FAILED;
+    memcpy(moved, start, MIN(len, need));
+    ph_free(start);
+    return moved;
+#else
+    return mremap(start, len, need, flags);
 #endif
+}
 
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL) 
-		return -1;
+/*
+ * map_decay - unmap the cached mappings released more than decay_ms
+ * ago, cache lock held. The cache decays as large requests come and
+ * go, and is flushed by malloc_trim.
+ */
+static void map_decay(long now)
+{
+    int i, old = 0;
 
-	// mm_checkheap(__LINE__);
-    return 0;
+    while (old < map_cache.n && now - map_cache.slot[old].stamp > conf.decay_ms) {
+		map_unmap(map_cache.slot[old].start, map_cache.slot[old].len);
+		map_cache.bytes -= map_cache.slot[old].len;
+		old++;
+    }
+    if (old == 0)
+		return;
+    for (i = old; i < map_cache.n; i++)
+		map_cache.slot[i - old] = map_cache.slot[i];
+    map_cache.n -= old;
 }
 
-/* 
- * mm_malloc - Allocate a block with at least size bytes of payload
- *  
+/*
+ * map_alloc - a mapped block with at least size bytes of payload
+ * 1. reuse the smallest cached mapping that fits, unmapping its tail
+ *    if more than a quarter of it would be wasted
+ * 2. otherwise map new (zero) memory
+ * *fresh (if fresh is not NULL) is set for new mappings
  */
-void *malloc(size_t size) 
+static void *map_alloc(size_t size, int *fresh)
 {
-    size_t asize;      /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;      
+    size_t pagesize = mem_pagesize();
+    size_t need, len = 0;
+    char *start = NULL;
+    int i, best = -1, zero;
 
-    dbg_printf("malloc %lu bytes\n", size);
+    if (size > (size_t)-1 - MAP_OVERHEAD - pagesize)
+		return NULL;
+    need = (size + MAP_OVERHEAD + pagesize-1) & ~(pagesize-1);
+
+    pthread_mutex_lock(&map_cache.lock);
+    map_decay(now_ms());
+    for (i = 0; i < map_cache.n; i++) {
+		if (map_cache.slot[i].len >= need && 
+			(best < 0 || map_cache.slot[i].len < map_cache.slot[best].len))
+			best = i;
+    }
+    if (best >= 0) {
+		start = map_cache.slot[best].start;
+		len = map_cache.slot[best].len;
+		map_cache.bytes -= len;
+		map_cache.n--;
+		for (i = best; i < map_cache.n; i++)
+			map_cache.slot[i] = map_cache.slot[i + 1];
+    }
+    pthread_mutex_unlock(&map_cache.lock);
 
-    if (heap_listp == 0){
-		mm_init();
+    if (start) {
+		if (len - need > need / 4) {
+			map_shrink(start, len, need);
+			len = need;
+		}
+		if (fresh)
+			*fresh = 0;
+    }
+    else {
+		if ((start = map_pages(need, &zero)) == NULL)
+			return NULL;
+		len = need;
+		if (fresh)
+			*fresh = zero;
+		MM_PROBE(grow, start, len);
+		MM_HOOK(on_grow, start, len);
     }
-    /* Ignore spurious requests */
-    if (size == 0)
-		return NULL;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)                                         
-		asize = 2*DSIZE;                                       
-    else
-		asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE); 
+    *(size_t *)start = len;
+    PUT(start + DSIZE, PACK(0, 1));          /* footer, tag bits */
+    PUT(start + DSIZE + WSIZE, PACK(0, 1));  /* header, tag bits */
+    pthread_mutex_lock(&map_cache.lock);
+    map_cache.live++;
+    map_cache.live_bytes += len;
+    map_index_add(start + MAP_OVERHEAD);
+    pthread_mutex_unlock(&map_cache.lock);
+    return start + MAP_OVERHEAD;
+}
 
-    /* Search the free list for a fit */
-    // mm_checkheap(__LINE__);
-    if ((bp = find_fit(asize)) != NULL) {
-    	// mm_checkheap(__LINE__);  
-		place(bp, asize);
-		// mm_checkheap(__LINE__);                   
+/*
+ * map_resize - resize the mapping of a mapped block (map_remap),
+ * MREMAP_MAYMOVE in flags lets it move. The tag stays in place.
+ * return the (possibly moved) block, NULL if it cannot be resized
+ */
+static void *map_resize(void *bp, size_t size, int flags)
+{
+    size_t pagesize = mem_pagesize();
+    char *start = (char *)bp - MAP_OVERHEAD, *moved;
+    size_t len = MAP_LEN(bp), need;
+
+    if (size > (size_t)-1 - MAP_OVERHEAD - pagesize)
+		return NULL;
+    need = (size + MAP_OVERHEAD + pagesize-1) & ~(pagesize-1);
+    if (need == len)
 		return bp;
+    /* off the index while it moves: a lookup sees it at one place */
+    pthread_mutex_lock(&map_cache.lock);
+    map_index_del(bp);
+    pthread_mutex_unlock(&map_cache.lock);
+    moved = map_remap(start, len, need, flags);
+    if (moved != MAP_FAILED) {
+		start = moved;
+		*(size_t *)start = need;
+		tag_account(GET_TAG(start + MAP_OVERHEAD), (long)(need - len), 0);
     }
+    pthread_mutex_lock(&map_cache.lock);
+    if (moved != MAP_FAILED)
+		map_cache.live_bytes += need - len;
+    map_index_add(start + MAP_OVERHEAD);
+    pthread_mutex_unlock(&map_cache.lock);
+    return moved != MAP_FAILED? start + MAP_OVERHEAD : NULL;
+}
 
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize,CHUNKSIZE);                 
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)  
-		return NULL;                                
-    place(bp, asize);   
-
-    return bp;
-} 
+/*
+ * map_index_pos - position of the first indexed mapped block at or
+ * after p, map lock held (binary search)
+ */
+static size_t map_index_pos(const void *p)
+{
+    size_t lo = 0, hi = map_cache.index_n, mid;
+
+    while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (map_cache.index[mid] < (char *)p)
+			lo = mid + 1;
+		else
+			hi = mid;
+    }
+    return lo;
+}
 
-/* 
- * free an allocated block
- * 1. coalesce with any ajacent free blocks
- * 2. put it in the beginning of the free list
+/*
+ * map_index_add - insert a mapped block into the address-ordered
+ * index, map lock held. The index is a mapping itself, grown with
+ * mremap: allocating here could recurse.
  */
-void free(void *bp)
+static void map_index_add(char *bp)
 {
-	dbg_printf("free at %p\n", bp);
-    if(bp == 0) 
-		return;
+    size_t i, cap;
+    void *p;
+
+    if (map_cache.index_n == map_cache.index_cap) {
+		cap = MAX(map_cache.index_cap * 2, mem_pagesize() / sizeof(char *));
+		p = map_cache.index? 
+		    mremap(map_cache.index, map_cache.index_cap * sizeof(char *), 
+		           cap * sizeof(char *), MREMAP_MAYMOVE) :
+		    mmap(NULL, cap * sizeof(char *), PROT_READ | PROT_WRITE, 
+		         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return;
+		map_cache.index = p;
+		map_cache.index_cap = cap;
+    }
+    i = map_index_pos(bp);
+    memmove(&map_cache.index[i + 1], &map_cache.index[i], 
+            (map_cache.index_n - i) * sizeof(char *));
+    map_cache.index[i] = bp;
+    map_cache.index_n++;
+}
 
-    size_t size = GET_SIZE(HDRP(bp));
+/*
+ * map_index_del - take a mapped block off the index, map lock held
+ */
+static void map_index_del(char *bp)
+{
+    size_t i = map_index_pos(bp);
 
-    if (heap_listp == 0)
-		mm_init();
+    if (i == map_cache.index_n || map_cache.index[i] != bp)
+		return;
+    map_cache.index_n--;
+    memmove(&map_cache.index[i], &map_cache.index[i + 1], 
+            (map_cache.index_n - i) * sizeof(char *));
+}
 
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
+/*
+ * map_release - release a mapped block to the mapping cache, evicting
+ * the oldest mappings to make room. A mapping larger than the whole
+ * cache, or any mapping when decay_ms is 0, is unmapped directly.
+ * With map_lazy the cached pages are MADV_FREE: the kernel may take
+ * them back under memory pressure instead of swapping them.
+ */
+static void map_release(void *bp)
+{
+    char *start = (char *)bp - MAP_OVERHEAD;
+    size_t len = MAP_LEN(bp);
+    int cache = conf.decay_ms > 0 && len <= conf.map_cache;
 
-	coalesce(bp);
-	// mm_checkheap(__LINE__);
+#ifdef MADV_FREE
+    if (cache && conf.map_lazy)
+		madvise(start, len, MADV_FREE);
+#endif
+    pthread_mutex_lock(&map_cache.lock);
+    map_cache.live--;
+    map_cache.live_bytes -= len;
+    map_index_del(bp);
+    map_decay(now_ms());
+    if (cache) {
+		while (map_cache.n == MAP_CACHE_SLOTS || 
+			   map_cache.bytes + len > conf.map_cache) {
+			map_unmap(map_cache.slot[0].start, map_cache.slot[0].len);
+			map_cache.bytes -= map_cache.slot[0].len;
+			map_cache.n--;
+			memmove(&map_cache.slot[0], &map_cache.slot[1], 
+			        map_cache.n * sizeof(map_cache.slot[0]));
+		}
+		map_cache.slot[map_cache.n].start = start;
+		map_cache.slot[map_cache.n].len = len;
+		map_cache.slot[map_cache.n].stamp = now_ms();
+		map_cache.n++;
+		map_cache.bytes += len;
+    }
+    else
+		map_unmap(start, len);
+    pthread_mutex_unlock(&map_cache.lock);
 }
 
 /*
- * mm_realloc - Naive implementation of realloc
+ * stats_start - map the statistics file and start its publisher,
+ * from the first allocation after init, mapped, mesh and small stack
+ * ones included (the thread may itself allocate, so never under the
+ * heap lock). On error the file is
+ * reported on stderr and not published.
  */
-void *realloc(void *ptr, size_t size)
+static void stats_start(void)
 {
-	dbg_printf("realloc at %p, %lu bytes\n", ptr, size);
-    size_t oldsize;
-    void *newptr;
+    pthread_t tid;
+    void *p;
+    int fd;
 
-    /* If size == 0 then this is just free, and we return NULL. */
-    if(size == 0) {
-		free(ptr);
-		return NULL;
+    if (!__atomic_exchange_n(&stats_pending, 0, __ATOMIC_ACQ_REL))
+		return;
+    fd = open(conf.stats_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, sizeof(struct mm_shm_stats)) == -1) {
+		perror(conf.stats_path);
+		if (fd != -1)
+			close(fd);
+		return;
     }
-
-    /* If oldptr is NULL, then this is just malloc. */
-    if(ptr == NULL) {
-		return malloc(size);
+    p = mmap(NULL, sizeof(struct mm_shm_stats), PROT_READ | PROT_WRITE, 
+             MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+		perror(conf.stats_path);
+		return;
     }
+    stats_shm = p;
+    stats_shm->version = MM_STATS_VERSION;
+    stats_shm->pid = getpid();
+    stats_publish();
+    __atomic_store_n(&stats_shm->magic, MM_STATS_MAGIC, __ATOMIC_RELEASE);
+    if (pthread_create(&tid, NULL, stats_worker, NULL) == 0)
+		pthread_detach(tid);
+}
 
-    newptr = malloc(size);
-
-    /* If realloc() fails the original block is left untouched  */
-    if(!newptr) {
-		return 0;
+/*
+ * stats_worker - publish the statistics every stats_ms
+ */
+static void *stats_worker(void *arg)
+{
+    struct timespec ts;
+
+    (void)arg;
+    ts.tv_sec = conf.stats_ms / 1000;
+    ts.tv_nsec = (conf.stats_ms % 1000) * 1000000;
+    for (;;) {
+		nanosleep(&ts, NULL);
+		stats_publish();
     }
+    return NULL;
+}
 
-    /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(ptr));
-    if(size < oldsize) oldsize = size;
-    memcpy(newptr, ptr, oldsize);
+/*
+ * stats_publish - take a snapshot and write it to the file under
+ * the seqlock: seq goes odd, the data is written, seq goes even.
+ * The heap lock is held only for a walk of the free list.
+ */
+static void stats_publish(void)
+{
+    struct mm_shm_stats st;
+    char *bp;
+    size_t size;
+    int i, t;
+
+    memset(&st, 0, sizeof(st));
+    st.magic = MM_STATS_MAGIC;
+    st.version = MM_STATS_VERSION;
+    st.pid = getpid();
+    st.stamp_ms = now_ms();
+
+    pthread_mutex_lock(&heap_lock);
+    if (heap_listp) {
+		st.heap_bytes = mem_heapsize();
+		for (bp = root; bp; bp = get_next_free(bp)) {
+			size = GET_SIZE(HDRP(bp));
+			st.free_blocks++;
+			st.free_bytes += size;
+			st.largest_free = MAX(st.largest_free, size);
+		}
+		if (wild) {
+			st.wild_bytes = GET_SIZE(HDRP(wild));
+			st.free_blocks++;
+			st.free_bytes += st.wild_bytes;
+			st.largest_free = MAX(st.largest_free, st.wild_bytes);
+		}
+    }
+    pthread_mutex_unlock(&heap_lock);
+    for (i = 0; i < NUM_SMALL && i < MM_STATS_SMALL; i++)
+		st.small[i] = small_count[i];
+
+    pthread_mutex_lock(&map_cache.lock);
+    st.mapped_blocks = map_cache.live;
+    st.mapped_bytes = map_cache.live_bytes;
+    st.cached_bytes = map_cache.bytes;
+    pthread_mutex_unlock(&map_cache.lock);
+
+    for (i = 0; i < TAG_SHARDS; i++) {
+		st.allocs += __atomic_load_n(&tag_stats[i].allocs, __ATOMIC_RELAXED);
+		for (t = 0; t < MM_NUM_TAGS && t < MM_STATS_TAGS; t++) {
+			st.tag[t].bytes += __atomic_load_n(&tag_stats[i].tag[t].bytes, 
+			                                   __ATOMIC_RELAXED);
+			st.tag[t].count += __atomic_load_n(&tag_stats[i].tag[t].count, 
+			                                   __ATOMIC_RELAXED);
+		}
+    }
+    for (t = 0; t < MM_STATS_TAGS; t++)
+		st.live += st.tag[t].count;
+
+    st.seq = stats_shm->seq + 1;
+    __atomic_store_n(&stats_shm->seq, st.seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(stats_shm, &st, sizeof(st));
+    __atomic_store_n(&stats_shm->seq, st.seq + 1, __ATOMIC_RELEASE);
+}
 
-    /* Free the old block. */
-    free(ptr);
+/*
+ * epoch_rec_get - the calling thread's epoch record: a record left by
+ * an exited thread, or a new one. NULL if none can be mapped.
+ */
+static struct epoch_rec *epoch_rec_get(void)
+{
+	struct epoch_rec *rec, *head;
+	int idle = 0;
+
+	if (my_rec)
+		return my_rec;
+	pthread_once(&epoch_once, epoch_key_create);
+	for (rec = __atomic_load_n(&epoch_recs, __ATOMIC_ACQUIRE); rec; 
+	     rec = rec->next, idle = 0)
+		if (__atomic_compare_exchange_n(&rec->in_use, &idle, 1, 0,
+		                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+	if (rec == NULL) {
+		rec = mmap(NULL, sizeof(*rec), PROT_READ | PROT_WRITE,
+		           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (rec == MAP_FAILED)
+			return NULL;
+		rec->in_use = 1;
+		head = __atomic_load_n(&epoch_recs, __ATOMIC_RELAXED);
+		do {
+			rec->next = head;
+		} while (!__atomic_compare_exchange_n(&epoch_recs, &head, rec, 1,
+		                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	my_rec = rec;
+	pthread_setspecific(epoch_key, rec);
+	return rec;
+}
 
-    return newptr;
+static void epoch_key_create(void)
+{
+	pthread_key_create(&epoch_key, epoch_rec_drop);
 }
 
 /*
- * calloc - you may want to look at mm-naive.c
- * This function is not tested by mdriver, but it is
- * needed to run the traces.
+ * epoch_rec_drop - an exiting thread leaves its sections, seals its
+ * open batch and gives its record up with the batches still waiting
  */
-void *calloc (size_t nmemb, size_t size) {
-	size_t bytes = nmemb*size;
-	char *newptr;
+static void epoch_rec_drop(void *arg)
+{
+	struct epoch_rec *rec = arg;
+
+	rec->nest = 0;
+	__atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+	if (rec->open.count)
+		epoch_seal(rec);
+	my_rec = NULL;
+	__atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
 
-	newptr = malloc(bytes);
-	memset(newptr, 0, bytes);
+/*
+ * epoch_retire - add ptr to the open batch of a record held by the
+ * caller, seal the batch when full
+ */
+static void epoch_retire(struct epoch_rec *rec, void *ptr)
+{
+	/* a seg engine block: its header size, it is never mapped */
+	size_t size = heap_ours()? block_size(ptr) : GET_SIZE(HDRP(ptr));
+
+	*(char **)ptr = NULL;
+	if (rec->open.head)
+		*(char **)rec->open.tail = ptr;
+	else
+		rec->open.head = ptr;
+	rec->open.tail = ptr;
+	rec->open.count++;
+	rec->open.bytes += size;
+	__atomic_fetch_add(&retired_bytes, size, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&retired_blocks, 1, __ATOMIC_RELAXED);
+	if (rec->open.count >= EPOCH_BATCH)
+		epoch_seal(rec);
+}
 
-    return newptr;
+/*
+ * epoch_seal - seal the open batch at the current epoch
+ * 1. try to advance the epoch, free the batches that are due
+ * 2. the batch takes a free slot, or joins the newest batch
+ */
+static void epoch_seal(struct epoch_rec *rec)
+{
+	struct epoch_batch *last;
+
+	rec->open.stamp = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	epoch_advance();
+	epoch_reclaim(rec);
+	if (rec->nsealed < EPOCH_SLOTS) {
+		rec->sealed[rec->nsealed++] = rec->open;
+	} else {
+		last = &rec->sealed[EPOCH_SLOTS - 1];
+		*(char **)last->tail = rec->open.head;
+		last->tail = rec->open.tail;
+		last->count += rec->open.count;
+		last->bytes += rec->open.bytes;
+		last->stamp = rec->open.stamp;
+	}
+	memset(&rec->open, 0, sizeof(rec->open));
 }
 
-/* 
- * The remaining routines are internal helper routines 
+/*
+ * epoch_advance - move the global epoch on if every thread inside a
+ * section has seen it. Return 1 if it moved (here or elsewhere).
  */
+static int epoch_advance(void)
+{
+	unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	unsigned long state;
+	struct epoch_rec *rec;
 
-/* 
- * extend_heap - Extend heap with free block and return its block pointer
+	if (__atomic_load_n(&epoch_blockers, __ATOMIC_SEQ_CST))
+		return 0;
+	for (rec = __atomic_load_n(&epoch_recs, __ATOMIC_ACQUIRE); rec; 
+	     rec = rec->next) {
+		state = __atomic_load_n(&rec->state, __ATOMIC_SEQ_CST);
+		if ((state & 1) && (state >> 1) != e)
+			return 0;
+	}
+	__atomic_compare_exchange_n(&global_epoch, &e, e + 1, 0, 
+	                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return 1;
+}
+
+/*
+ * epoch_reclaim - free the sealed batches of a record (held by the
+ * caller) that are two epochs old, through the engine running the
+ * heap; return the blocks freed
  */
+static size_t epoch_reclaim(struct epoch_rec *rec)
+{
+	unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	struct epoch_batch *batch;
+	size_t n = 0;
+	char *bp;
+	int i;
+
+	for (i = 0; i < rec->nsealed && rec->sealed[i].stamp + 2 <= e; i++) {
+		batch = &rec->sealed[i];
+		while ((bp = batch->head) != NULL) {
+			batch->head = *(char **)bp;
+#ifdef MM_ENGINES
+			mm_engine()->dealloc(bp);
+#else
+			free(bp);
+#endif
+		}
+		__atomic_fetch_sub(&retired_bytes, batch->bytes, __ATOMIC_RELAXED);
+		__atomic_fetch_sub(&retired_blocks, batch->count, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&retired_freed, batch->count, __ATOMIC_RELAXED);
+		n += batch->count;
+	}
+	if (i > 0) {
+		memmove(rec->sealed, rec->sealed + i, 
+		        (rec->nsealed - i) * sizeof(rec->sealed[0]));
+		rec->nsealed -= i;
+	}
+	return n;
+}
 
-static void *extend_heap(size_t words) 
+/*
+ * trim_wild - release the wilderness pages beyond pad once the part
+ * still in memory exceeds trim_threshold. heap_released remembers
+ * where the released pages start so they are not released twice:
+ * only the pages from lo up to it are released.
+ */
+static void trim_wild(size_t pad)
 {
-    char *bp;
-    size_t size;
+    char *lo = (char *)wild + DSIZE + pad;
+    char *hi = heap_released? MIN(heap_released, FTRP(wild)) : FTRP(wild);
 
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
-    if ((long)(bp = mem_sbrk(size)) == -1)  
-		return NULL;                                        
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */   
-    PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */   
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */ 
-	
-    /* Coalesce if the previous block was free */
-    return coalesce(bp);                                         
+    if (conf.hugepage)
+		lo = HUGE_UP(lo);
+    if (hi <= lo || (size_t)(hi - lo) <= conf.trim_threshold)
+		return;
+    release_pages(lo, hi, conf.hugepage? HUGE_PAGE : mem_pagesize());
+    heap_released = lo;
+}
+
+/*
+ * release_free - file a free, coalesced block: the topmost one
+ * becomes the wilderness, any other goes to the front of the list
+ */
+static void release_free(void *bp)
+{
+    if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0)
+		wild = bp;
+    else
+		insertFree(bp);
 }
 
 /*
  * coalesce - Boundary tag coalescing. Return ptr to coalesced block
- * 1. coalesce with ajacent blocks
- * 2. place the free'd and coalesce'd block in the beginning of free list
+ * 1. coalesce with ajacent blocks, taking them off the free list
+ *    (or out of the wilderness)
+ * 2. place the free'd and coalesce'd block in the beginning of free list,
+ *    or make it the wilderness if it is the topmost block
  */
 static void *coalesce(void *bp) 
 {
@@ -306,58 +2731,53 @@ static void *coalesce(void *bp)
     size_t size = GET_SIZE(HDRP(bp));
 
     if (prev_alloc && next_alloc) {            /* Case 1 */
-    	/* inser to the list directly */
-    	insertFree(bp);
-    	// mm_checkheap(__LINE__);
-    	return bp;
+    	/* nothing to merge */
     }
 
     else if (prev_alloc && !next_alloc) {      /* Case 2 */
 		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
 		/* delete the next free block from list */
-		deleteFree(NEXT_BLKP(bp));
+		if (NEXT_BLKP(bp) == wild)
+			wild = NULL;
+		else
+			deleteFree(NEXT_BLKP(bp));
+		idx_clear(NEXT_BLKP(bp));
 		/* coalesce with the next */
 		PUT(HDRP(bp), PACK(size, 0));
 		PUT(FTRP(bp), PACK(size, 0));
-		/* insert free block into the list */
-		insertFree(bp);
-		// mm_checkheap(__LINE__);
     }
 
     else if (!prev_alloc && next_alloc) {      /* Case 3 */
 		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
 		/* delete the previous free block from list */
 		deleteFree(PREV_BLKP(bp));
+		idx_clear(bp);
 		/* coalesce with the prev */
 		PUT(FTRP(bp), PACK(size, 0));
 		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
 		bp = PREV_BLKP(bp);
-		/* insert free block into the list */
-		insertFree(bp);
-		// mm_checkheap(__LINE__);
     }
 
     else {                                     /* Case 4 */
 		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
 	        	GET_SIZE(FTRP(NEXT_BLKP(bp)));
 	    /* delete blocks in both sides */
-	    deleteFree(NEXT_BLKP(bp));
+		if (NEXT_BLKP(bp) == wild)
+			wild = NULL;
+		else
+			deleteFree(NEXT_BLKP(bp));
 	    deleteFree(PREV_BLKP(bp));
+		idx_clear(NEXT_BLKP(bp));
+		idx_clear(bp);
 	    /* coalesce with both sides */    	
 		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
 		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
 		bp = PREV_BLKP(bp);
-		/* insert free block into the list */
-		insertFree(bp);
-		// mm_checkheap(__LINE__);
     }
 
-#ifdef NEXT_FIT
-    /* Make sure the rover isn't pointing into the free block */
-    /* that we just coalesced */
-    if ((rover > (char *)bp) && (rover < NEXT_BLKP(bp))) 
-	rover = bp;
-#endif
+    /* insert free block into the list, or keep it as the wilderness */
+    release_free(bp);
+    // mm_checkheap(__LINE__);
     return bp;
 } 
 
@@ -381,6 +2801,7 @@ static void place(void *bp, size_t asize)
 		bp = NEXT_BLKP(bp);
 		PUT(HDRP(bp), PACK(csize-asize, 0));
 		PUT(FTRP(bp), PACK(csize-asize, 0));
+		idx_set(bp);
 		/* splitted blk inherit position */			
 		put_prev_val(bp, prev_free_val(old_bp));
 		put_next_val(bp, next_free_val(old_bp));
@@ -392,6 +2813,9 @@ static void place(void *bp, size_t asize)
 		if (old_bp == root) {
 			root = bp;
 		}
+		if (old_bp == rover) {
+			rover = bp;
+		}
 		// mm_checkheap(__LINE__);
     }
     else { 
@@ -409,36 +2833,75 @@ static void place(void *bp, size_t asize)
 
 /* 
  * find_fit - Find a fit for a block with asize bytes
- * first fit 
- * starts from the free list root
+ * first fit: starts from the free list root
+ * next fit: starts from the rover, wraps around to the root
+ * best fit: smallest fitting block, stops early on an exact fit
  */
 static void *find_fit(size_t asize)
 {
+    char *bp, *best = NULL;
+
+    switch (conf.policy) {
+    case FIT_NEXT:
+		/* search from the rover to the end of list */
+		for (bp = rover; bp; bp = get_next_free(bp))
+			if (GET_SIZE(HDRP(bp)) >= asize)
+				return (rover = bp);
+		/* search from start of list to old rover */
+		for (bp = root; bp && bp != rover; bp = get_next_free(bp))
+			if (GET_SIZE(HDRP(bp)) >= asize)
+				return (rover = bp);
+		return NULL;  /* no fit found */
+    case FIT_BEST:
+		for (bp = root; bp; bp = get_next_free(bp)) {
+			if (GET_SIZE(HDRP(bp)) == asize)
+				return bp;
+			if (GET_SIZE(HDRP(bp)) > asize && 
+				(!best || GET_SIZE(HDRP(bp)) < GET_SIZE(HDRP(best))))
+				best = bp;
+		}
+		return best;
+    default:
+		/* start from root until hit NULL ptr */
+		for (bp = root; bp; bp = get_next_free(bp)) {
+			if (GET_SIZE(HDRP(bp)) >= asize)
+				return bp;
+		}
+		return NULL; /* No fit */
+    }
+}
 
-#ifdef NEXT_FIT 
-    /* Next fit search */
-    char *oldrover = rover;
+/*
+ * huge_fit - find_fit for hugepage: the first fit that does not spill
+ * into an empty huge page, else the first fit
+ */
+static void *huge_fit(size_t asize)
+{
+    char *bp, *spill = NULL;
 
-    /* Search from the rover to the end of list */
-    for ( ; GET_SIZE(HDRP(rover)) > 0; rover = NEXT_BLKP(rover))
-	if (!GET_ALLOC(HDRP(rover)) && (asize <= GET_SIZE(HDRP(rover))))
-	    return rover;
+    for (bp = root; bp; bp = get_next_free(bp)) {
+		if (GET_SIZE(HDRP(bp)) < asize)
+			continue;
+		if (!huge_spill(bp, asize))
+			return bp;
+		if (spill == NULL)
+			spill = bp;
+    }
+    return spill;
+}
 
-    /* search from start of list to old rover */
-    for (rover = heap_listp; rover < oldrover; rover = NEXT_BLKP(rover))
-	if (!GET_ALLOC(HDRP(rover)) && (asize <= GET_SIZE(HDRP(rover))))
-	    return rover;
+/*
+ * huge_spill - whether placing asize bytes at the free block bp
+ * reaches a huge page the block covers whole, an empty one. The
+ * neighbours of a free block are allocated, so the huge pages at its
+ * ends are in use.
+ */
+static int huge_spill(void *bp, size_t asize)
+{
+    char *lo = HDRP(bp);
+    char *first = HUGE_UP(lo);  /* first huge page inside the block */
 
-    return NULL;  /* no fit found */
-#else 
-    char *bp;
-	/* start from root until hit NULL ptr */
-	for (bp = root; bp; bp = get_next_free(bp)) {
-		if (GET_SIZE(HDRP(bp)) >= asize)
-			return bp;
-	}
-    return NULL; /* No fit */
-#endif
+    return first < HUGE_DOWN(lo + GET_SIZE(lo)) && lo + asize > first;
 }
 
 /*
@@ -455,13 +2918,17 @@ static void deleteFree(void *bp) {
 		/* bp's prev points to bp's next */
 		put_next_val(itop(prev_free), next_free); 
 	}
+	else {
+		/* root free block, its next (or NULL) becomes the root */
+		root = get_next_free(bp);
+	}
+	/* the next fit rover moves on to the next block */
+	if (bp == rover) {
+		rover = get_next_free(bp);
+	}
 	if (next_free) {
 		/* bp's next points to bp's prev */
 		put_prev_val(itop(next_free), prev_free);
-		/* root free block */
-		if (bp == root) {
-			root = get_next_free(bp);
-		}
 	}
 	// dbg_printf("AFTER DELETE_FREE %p\n", bp);
 	// printImg();
@@ -471,8 +2938,6 @@ static void deleteFree(void *bp) {
  * insert a free block in the front of the list
  */
 static void insertFree(void *bp) {
-	// dbg_printf("BEFORE INSERT_FREE %p\n", bp);
-	// printImg();	
 	/* new 1st has NULL prev */ 
 	put_prev_val(bp, 0); 
 
@@ -480,22 +2945,14 @@ static void insertFree(void *bp) {
 	if (!root) {
 		put_next_val(bp, 0);
 	}
-	/* the free'd blk was coalesced with a front block behind it */
-	else if (root > (char *)(bp) && root < NEXT_BLKP(bp)) {
-		put_next_val(bp, next_free_val(root));
-		if ((next_free_val(bp)))
-			put_prev_val(itop(next_free_val(bp)), ptoi(bp));
-	}
-	/* a normal free blk not coalesced with a front block before it */
-	else if (bp != root){
+	/* old 1st points back to the new one */
+	else {
 		put_next_val(bp, ptoi(root));
 		put_prev_val(root, ptoi(bp));
 	}
 	/* root points to 1st free block */
 	root = bp;
 	// mm_checkheap(__LINE__);
-	// dbg_printf("AFTER INSERT_FREE %p\n", bp);
-	// printImg();
 }
 
 /* convert a 64-bit ptr value to a 32-bit unsigned int value */
@@ -536,22 +2993,6 @@ static char *get_prev_free(void *bp) {
  * Heap consistency checker
  */ 
 
-/*
- * Return whether the pointer is in the heap.
- * May be useful for debugging.
- */
-static int in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
-}
-
-/*
- * Return whether the pointer is aligned.
- * May be useful for debugging.
- */
-static int aligned(const void *p) {
-    return (size_t)ALIGN(p) == (size_t)p;
-}
-
 /*
  * mm_checkheap
  */
@@ -566,90 +3007,41 @@ void mm_checkheap(int lineno) {
 	/* check heap start */
 	if (!in_heap(heap_listp)) {
 		dbg_printf("line %d: heap_listp not in heap!\n", lineno);
-		exit(1);
+		CHECK_FAIL();
 	}
 	/* check padding */
 	if (GET(heap_base) != 0) {
 		dbg_printf("line %d: intial padding wrong!\n", lineno);
-		exit(1);
-	}
-	/* check epilogue and prologue */
-	hdrp = HDRP(heap_listp);
-	ftrp = FTRP(heap_listp);
-	if ((GET_SIZE(hdrp) != DSIZE) 
-		|| (GET_SIZE(ftrp) != DSIZE)) {
-		dbg_printf("line %d: prologue size not correct!\n", lineno);
-		dbg_printf("header size: %d\n", (GET_SIZE(hdrp)));
-		dbg_printf("footer size: %d\n", (GET_SIZE(ftrp)));
-		exit(1);
-	}
-	if ((!GET_ALLOC(hdrp)) || (!GET_ALLOC(ftrp))) {
-		dbg_printf("line %d: prologue not allocated!\n", lineno);
-		exit(1);
-	}
-	hdrp = HDRP(mem_heap_hi()+1);
-	if (GET_SIZE(hdrp) != 0) {
-		dbg_printf("in get_size\n");
-		dbg_printf("line %d: epilogue size not 0!\n", lineno);
-		dbg_printf("epilogue size: %u\n", GET_SIZE(hdrp));
-		dbg_printf("heap size: %lu\n", mem_heapsize());
-		exit(1);
-	}
-	if (GET_ALLOC(hdrp) != 1) {
-		dbg_printf("in get alloc\n");
-		dbg_printf("line %d: epilogue not allocated!\n", lineno);
-		exit(1);
-	}
-	/* traverse through all blocks */
-	bp = NEXT_BLKP(heap_listp);
-	prev_bp = heap_listp;
-	for (; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+		CHECK_FAIL();
+	}
+	/* prologue, epilogue, blocks and coalescing */
+	core_checkheap(heap_listp, lineno);
+	/* allocated blocks keep their footer too */
+	for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
 		hdrp = HDRP(bp);
 		ftrp = FTRP(bp);
-		/* check block address alignment */
-		if (!aligned(bp)) {
-			dbg_printf("line %d: blk not aligned\n", lineno);
-			dbg_printf("blk at %p, blk size %u, alloc: %u", 
-				        bp, GET_SIZE(hdrp), GET_ALLOC(hdrp));
-			exit(1);
-		}
-		/* check heap boundaries */
-		if (!in_heap(bp)) {
-			dbg_printf("line %d: blk not in heap boundaries\n", lineno);
-			dbg_printf("blk at %p:", bp);
-			exit(1);
-		}
-		/* check block's header and footer */
-		if (GET_SIZE(hdrp) < MIN_BLK_SIZE) {
-			dbg_printf("line %d: blk at %p h, header size %u < MIN_BLK_SIZE\n", 
-				        lineno, bp, GET_SIZE(hdrp));
-			exit(1);
-		}
-		if (GET_SIZE(ftrp) < MIN_BLK_SIZE) {
-			dbg_printf("line %d: blk at %p h, footer size %u < MIN_BLK_SIZE\n", 
-			            lineno, bp, GET_SIZE(ftrp));
-			exit(1);
-		}
 		if (GET_SIZE(hdrp) != GET_SIZE(ftrp)) {
 			dbg_printf("line %d: blk at %p hdr ftr size inconsistent!\n", 
 				        lineno, bp);
 			dbg_printf("line %d: hdr size: %u, ftr size: %u", 
 				        lineno, GET_SIZE(hdrp), GET_SIZE(ftrp));
-			exit(1);
+			CHECK_FAIL();
 		}
 		if (GET_ALLOC(hdrp) != GET_ALLOC(ftrp)) {
 			dbg_printf("line %d: blk at %p hdr ftr alloc inconsistent!\n", 
 				        lineno, bp);
 			dbg_printf("line %d: hdr alloc: %u, ftr alloc: %u", 
 				        lineno, GET_ALLOC(hdrp), GET_ALLOC(ftrp));
-			exit(1);		
+			CHECK_FAIL();		
 		}
-		/* check coalescing */
-		if ((GET_ALLOC(HDRP(prev_bp)) == 0) && GET_ALLOC(hdrp)) {
-			dbg_printf("line %d: two consecutive free blokcs!\n", 
-				        lineno);
-			exit(1);
+#ifdef SBRK_ZEROED
+		/* only the wilderness may reach above heap_clean (fresh blocks) */
+		if (bp != wild && NEXT_BLKP(bp) > heap_clean) {
+			dbg_printf("line %d: blk at %p ends above heap_clean %p!\n", 
+				        lineno, bp, heap_clean);
+			CHECK_FAIL();
 		}
+#endif
 	}
 	/* check heap end */
 
@@ -667,7 +3059,7 @@ void mm_checkheap(int lineno) {
 					 		prev_bp, itop(next_free_val(prev_bp)), 
 					        bp,      itop(prev_free_val(bp)));
 				printImg();
-				exit(1);
+				CHECK_FAIL();
 			}
 		}
 		/* free list pointers in heap */
@@ -677,7 +3069,7 @@ void mm_checkheap(int lineno) {
 		/* infinite list something wrong */
 		if (timer >= (1 << 28)) {
 			dbg_printf("line %d: no ending node in the list!\n", lineno);
-			exit(1);
+			CHECK_FAIL();
 		}
 		timer++;
 	}
@@ -688,12 +3080,31 @@ void mm_checkheap(int lineno) {
 			countAll++;
 	}
 	for (bp = root; bp; bp = get_next_free(bp)) {
+		if (bp == wild) {
+			dbg_printf("line %d: wilderness in the free list!\n", lineno);
+			CHECK_FAIL();
+		}
 		countFree++;
 	}
+	/* check wilderness: free, topmost, counted apart from the list */
+	if (wild) {
+		if (GET_ALLOC(HDRP(wild)) || GET_SIZE(HDRP(NEXT_BLKP(wild))) != 0) {
+			dbg_printf("line %d: wilderness %p not the free top block!\n", 
+				        lineno, wild);
+			printImg();
+			CHECK_FAIL();
+		}
+		countFree++;
+	}
+	else if (!GET_ALLOC(FTRP(PREV_BLKP(mem_heap_hi()+1)))) {
+		dbg_printf("line %d: free top block but no wilderness!\n", lineno);
+		printImg();
+		CHECK_FAIL();
+	}
 	if (countAll != countFree) {
 		dbg_printf("line %d: free blokcs number inconsistent!\n", lineno);
 		printImg();
-		exit(1);
+		CHECK_FAIL();
 	}
 	/* check free list end */
 	/* get gcc to be quite */
@@ -718,6 +3129,14 @@ static void printImg(void) {
 		dbg_printf("[%p, %u, %u] (%p, %p) -> ", bp, GET_SIZE(HDRP(bp)),
 			        GET_ALLOC(HDRP(bp)), get_prev_free(bp), get_next_free(bp));
 	}
-	dbg_printf("\n**********************************************************\n");
+	dbg_printf("\nthe wilderness: %p\n", wild);
+	dbg_printf("**********************************************************\n");
 	return;
-}
\ No newline at end of file
+}
+
+#ifdef MM_ENGINES
+const struct mm_engine mm_list_engine = {
+	"list", list_init, list_malloc, list_free, list_realloc, list_calloc, list_checkheap,
+	list_block_of, list_heap_stats
+};
+#endif /* def MM_ENGINES */
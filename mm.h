@@ -0,0 +1,210 @@
+/*
+ * mm.h
+ *
+ * Interface to the allocator in mm.c (and mm-seglist.c).
+ * The driver builds with -DDRIVER, which renames the standard
+ * entry points to the mm_ prefixed names below.
+ */
+#ifndef MM_H
+#define MM_H
+
+#include <stdio.h>
+#include <malloc.h>
+
+extern int mm_init(void);
+extern void *mm_malloc(size_t size);
+extern void mm_free(void *ptr);
+extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void mm_checkheap(int lineno);
+
+/*
+ * Heap pre-warming: mm_reserve extends the heap by at least bytes
+ * so later requests are served without growing the heap.
+ * MM_RESERVE_PREFAULT touches every new page up front,
+ * MM_RESERVE_MLOCK locks the new pages into memory.
+ * Return 0 on success, -1 if the heap could not grow, and
+ * MM_RESERVE_NOLOCK if it grew but the pages could not be locked
+ * (errno from mlock, e.g. ENOMEM or EPERM past RLIMIT_MEMLOCK).
+ */
+#define MM_RESERVE_PREFAULT 0x1
+#define MM_RESERVE_MLOCK    0x2
+#define MM_RESERVE_NOLOCK   1   /* return: grown, not locked */
+
+extern int mm_reserve(size_t bytes, int flags);
+
+/*
+ * Size feedback: mm_malloc_at_least stores the usable size of the
+ * returned block in *usable. mm_try_expand grows an allocated block in
+ * place and returns its new usable size, or 0 if it would have to move.
+ */
+extern void *mm_malloc_at_least(size_t size, size_t *usable);
+extern size_t mm_try_expand(void *ptr, size_t new_size);
+
+/*
+ * Interior pointers: mm_block_of maps any address to the allocated
+ * block containing it, returning the payload start and storing the
+ * usable size in *size, or NULL if the address is in no allocated
+ * block. It uses a side index, never a walk of the heap.
+ */
+extern void *mm_block_of(const void *addr, size_t *size);
+
+/*
+ * Locality hint: mm_malloc_near allocates like malloc but prefers a
+ * free block next to the block holding hint (within a page), so
+ * objects traversed together stay close. A NULL or unknown hint, or a
+ * request for a mapped block, is a plain malloc.
+ */
+extern void *mm_malloc_near(const void *hint, size_t size);
+
+/*
+ * Heap statistics any engine keeps: the heap size and its free
+ * blocks, from a walk of the heap.
+ */
+struct mm_heap_stats {
+	size_t heap_bytes;     /* heap size */
+	size_t free_bytes;     /* free blocks */
+	size_t free_blocks;
+	size_t largest_free;   /* largest free block */
+};
+
+extern void mm_heap_stats(struct mm_heap_stats *stats);
+
+/*
+ * Snapshot check: mm_check_snapshot forks, and the child runs
+ * mm_checkheap and a fragmentation analysis on its copy-on-write image
+ * of the heap, reporting back over a pipe. The heap is locked only
+ * across the fork; the calling thread waits for the child, others go
+ * on. A child that has not reported after 30 s is killed (status 137).
+ * The child prints nothing. Return 0 if the child ran (status tells if
+ * the heap passed), -1 if it could not be started (errno ENOTSUP if
+ * the seg engine runs the heap). Mapped blocks are not part of it.
+ */
+#define MM_SNAP_BINS 32
+
+struct mm_snapshot {
+	int status;             /* 0 consistent, else the checker's exit status */
+	size_t heap_bytes;      /* heap size */
+	size_t alloc_blocks;    /* allocated blocks, small stacks included */
+	size_t alloc_bytes;
+	size_t free_blocks;
+	size_t free_bytes;
+	size_t largest_free;
+	size_t free_hist[MM_SNAP_BINS]; /* free blocks of 2^i to 2^(i+1)-1 bytes */
+	long check_ms;          /* time the child took */
+};
+
+extern int mm_check_snapshot(struct mm_snapshot *snap);
+
+/*
+ * Engines: built with -DMM_ENGINES, mm.c ("list", explicit free list)
+ * and mm-seglist.c ("seg", segregated fits) link into one binary
+ * behind the entry points of mm-engine.c (see mm-engine.h).
+ * mm_engine_select picks the engine of the next heap: call it before
+ * mm_init, with no blocks live. Without it the MM_ENGINE environment
+ * variable names the engine, "list" by default. Return 0 if success,
+ * -1 for an unknown name. Both engines implement mm_init, malloc,
+ * free, realloc, calloc, mm_checkheap, mm_block_of and mm_heap_stats;
+ * the other interfaces here are the list engine's. While the seg
+ * engine runs the heap they refuse: allocations return NULL, the
+ * others their failure value (0 or -1). Deferred frees (mm_epoch_*,
+ * mm_free_deferred) work with either engine.
+ */
+extern int mm_engine_select(const char *name);
+extern const char *mm_engine_name(void);
+
+/*
+ * Per-tag accounting: every allocated block carries one of
+ * MM_NUM_TAGS tags, recovered from the block itself on free.
+ * malloc charges the calling thread's current tag (0 by default),
+ * mm_malloc_tagged an explicit one. mm_tag_stats reports the live
+ * bytes and blocks charged to a tag.
+ */
+#define MM_NUM_TAGS 16
+
+struct mm_tag_stats {
+	size_t bytes;   /* live bytes, block sizes including overhead */
+	size_t count;   /* live blocks */
+};
+
+extern int mm_set_tag(int tag);
+extern int mm_get_tag(void);
+extern void *mm_malloc_tagged(size_t size, int tag);
+extern int mm_tag_of(void *ptr);
+extern int mm_tag_stats(int tag, struct mm_tag_stats *stats);
+
+/*
+ * Deferred free for lock-free structures (epoch based reclamation).
+ * Readers bracket their accesses with mm_epoch_enter/mm_epoch_exit
+ * (sections nest); a block unlinked from a shared structure is passed
+ * to mm_free_deferred and freed once every section that may have seen
+ * it has ended. Retired blocks are batched per thread and freed in
+ * bulk as the global epoch moves on; a stalled reader holds them back,
+ * and mm_epoch_stats counts them. mm_epoch_reclaim frees what is due
+ * now, mm_epoch_barrier waits for the sections open now to end.
+ * A thread whose epoch record cannot be mapped is still protected: its
+ * sections hold the epoch still for all threads until they end.
+ */
+struct mm_epoch_stats {
+	unsigned long epoch;   /* global epoch */
+	size_t retired_bytes;  /* retired, not freed yet, block sizes */
+	size_t retired_blocks;
+	size_t freed_blocks;   /* retired and freed, cumulative */
+};
+
+extern void mm_epoch_enter(void);
+extern void mm_epoch_exit(void);
+extern void mm_free_deferred(void *ptr);
+extern size_t mm_epoch_reclaim(void);
+extern void mm_epoch_barrier(void);
+extern void mm_epoch_stats(struct mm_epoch_stats *stats);
+
+/*
+ * Event hooks, called with the hooks' arg last:
+ * - on_alloc after the block is allocated, never for a request that
+ *   returns NULL (size 0, out of memory)
+ * - on_free before the block is freed, so ptr is still valid
+ * - on_realloc once new_ptr holds the data, before old_ptr is freed
+ *   if the block moved
+ * - on_grow after the memory is added, on_purge after it is released
+ * grow and purge may run with a lock held and must not allocate.
+ * The same events are USDT probes mm:alloc, mm:dealloc, mm:resize,
+ * mm:grow and mm:purge when built with <sys/sdt.h>.
+ */
+struct mm_hooks {
+	void (*on_alloc)(void *ptr, size_t size, void *arg);
+	void (*on_free)(void *ptr, void *arg);
+	void (*on_realloc)(void *old_ptr, void *new_ptr, size_t size, void *arg);
+	void (*on_grow)(void *start, size_t bytes, void *arg);  /* heap grown, mapped */
+	void (*on_purge)(void *start, size_t bytes, void *arg); /* released, unmapped */
+	void *arg;
+};
+
+extern void mm_set_hooks(const struct mm_hooks *hooks);
+
+/*
+ * glibc compatible statistics and tuning, for drop-in use
+ * (mallinfo2, mallopt, malloc_trim and malloc_stats outside DRIVER).
+ */
+extern struct mallinfo2 mm_mallinfo2(void);
+extern int mm_mallopt(int param, int value);
+extern int mm_malloc_trim(size_t pad);
+extern void mm_malloc_stats(void);
+
+/*
+ * Run-time configuration, read once at init from the MM_CONF
+ * environment variable: comma separated key=value pairs with sizes
+ * taking K, M or G suffixes, e.g. "chunk=1M,policy=best". Keys:
+ * chunk, trim_threshold, top_pad, small_max, small_cache, zero_min,
+ * policy (first, next or best), mmap_threshold (requests mapped on
+ * their own), map_cache (bytes of released mappings kept for reuse),
+ * decay_ms (how long they are kept), map_lazy (keep them MADV_FREE),
+ * hugepage (grow, fill and trim the heap by 2 MB huge pages),
+ * stats (publish statistics to this file, see mm-stats.h) and
+ * stats_ms (how often).
+ * mm_conf_string writes the effective configuration in the same
+ * syntax and returns its length.
+ */
+extern size_t mm_conf_string(char *buf, size_t len);
+
+#endif /* MM_H */